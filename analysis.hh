@@ -0,0 +1,378 @@
+#ifndef ANALYSIS_HH
+#define ANALYSIS_HH
+
+#include <algorithm>             // for min, max, copy_n
+#include <chrono>                // for steady_clock, duration
+#include <cmath>                 // for atan, cos, sqrt
+#include <complex>               // for complex, norm
+#include <fstream>               // for ofstream
+#include <limits>                // for numeric_limits
+#include <ostream>               // for ostream, endl
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <vector>                // for vector
+
+#include "fft.hh"                // for DFT
+#include "parallel.hh"           // for parallel_for
+#include "sink.hh"               // for Zeta_sink
+#include "stats.hh"              // for Stats, merge_stats
+#include "types.hh"              // for Zeta, size3, Vec3
+
+/// @file
+/// Analysis of wavy surface by time slabs as it is generated.
+///
+/// The time series of each point of the surface is analysed separately
+/// (rows along x are processed in parallel), so only a few values per point
+/// and the last @welch_size layers are stored:
+/// - zero up-crossing wave heights and periods,
+/// - maxima and minima of each point (record),
+/// - the histogram of elevation,
+/// - frequency spectrum averaged over all points by Welch's method
+///   (Hann window, half-overlapping segments).
+
+namespace autoreg {
+
+	/// Frequency spectrum along t averaged over all points of the surface.
+	struct Wave_spectrum {
+		/// Frequencies in cycles per unit of time.
+		std::vector<double> frequency;
+		/// One-sided spectral density.
+		std::vector<double> density;
+		/// The number of averaged segments of each point.
+		long segments = 0;
+
+		/// Zeroth spectral moment, i.e. elevation variance.
+		double
+		m0() const {
+			double sum = 0;
+			for (double s : density) sum += s;
+			return frequency.size() > 1 ? sum*frequency[1] : 0.0;
+		}
+
+		/// Frequency of the spectrum peak.
+		double
+		peak_frequency() const {
+			const size_t k = std::max_element(density.begin(), density.end()) - density.begin();
+			return k < frequency.size() ? frequency[k] : 0.0;
+		}
+	};
+
+	/// Mean of the highest third of the values counted in histogram of @s
+	/// (values are replaced by bin centres, overflow by the maximum).
+	template<class T>
+	double
+	highest_third_mean(const Stats<T>& s) {
+		const int nbins = s.histogram.size();
+		const double width = (s.hi - s.lo) / std::max(nbins, 1);
+		double n = double(s.count) / 3;
+		double sum = 0, taken = 0;
+		auto take = [&] (double count, double value) {
+			const double k = std::min(count, n - taken);
+			if (k > 0) {
+				sum += k*value;
+				taken += k;
+			}
+		};
+		take(s.overflow, s.max);
+		for (int i=nbins-1; i>=0 && taken<n; --i) {
+			take(s.histogram[i], s.lo + (i + 0.5)*width);
+		}
+		return taken > 0 ? sum / taken : 0.0;
+	}
+
+	/// Computes wave statistics of the surface passed by slabs and writes
+	/// them to @filename (if not empty) in end(). @sigma is the standard
+	/// deviation of elevation that determines histogram bins.
+	template<class T>
+	struct Zeta_analysis_sink: public Zeta_sink<T> {
+
+		Zeta_analysis_sink(const std::string& filename, double sigma, int welch_size = 64):
+		_filename(filename),
+		_sigma(sigma),
+		_welch_size(welch_size),
+		_dft(welch_size),
+		_window(welch_size)
+		{
+			if (welch_size < 4) {
+				throw std::runtime_error("welch_size < 4");
+			}
+			// Hann window
+			const double pi = 4*std::atan(1.0);
+			for (int i=0; i<welch_size; ++i) {
+				_window[i] = T(0.5 - 0.5*std::cos(2*pi*i/welch_size));
+				_window_power += double(_window[i])*_window[i];
+			}
+		}
+
+		void
+		begin(const size3& zsize, const Vec3<T>& zdelta) override {
+			_zsize = zsize;
+			_zdelta = zdelta;
+			const long npoints = long(zsize(1))*zsize(2);
+			_points.assign(npoints, Point());
+			_ring.assign(long(_welch_size)*npoints, T(0));
+			_rows.assign(zsize(1), Row(_sigma, _welch_size/2 + 1));
+			_segments = 0;
+			_time = std::chrono::steady_clock::duration(0);
+		}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			const auto t0 = std::chrono::steady_clock::now();
+			const int n = slab.extent(0);
+			const int x1 = slab.extent(1);
+			parallel_for(0, x1, [&] (int first, int last) {
+				std::vector<std::complex<T>> line(_welch_size), work(_welch_size);
+				for (int x=first; x<last; ++x) {
+					analyse_row(slab, t, x, line, work);
+				}
+			});
+			for (int i=0; i<n; ++i) {
+				if (segment_ends(t + i)) ++_segments;
+			}
+			_time += std::chrono::steady_clock::now() - t0;
+		}
+
+		void
+		end() override {
+			const auto t0 = std::chrono::steady_clock::now();
+			if (!_filename.empty()) {
+				std::ofstream out(_filename);
+				write_report(out);
+				if (!out) {
+					throw std::runtime_error("error writing " + _filename);
+				}
+			}
+			_time += std::chrono::steady_clock::now() - t0;
+		}
+
+		/// Elevation of all points.
+		Stats<T>
+		elevation() const {
+			return merge_rows([] (const Row& r) -> const Stats<T>& { return r.elevation; });
+		}
+
+		/// Zero up-crossing wave heights.
+		Stats<T>
+		heights() const {
+			return merge_rows([] (const Row& r) -> const Stats<T>& { return r.heights; });
+		}
+
+		/// Zero up-crossing wave periods.
+		Stats<T>
+		periods() const {
+			return merge_rows([] (const Row& r) -> const Stats<T>& { return r.periods; });
+		}
+
+		/// Statistics of maxima (@maxima = true) or minima of the records
+		/// of all points.
+		Stats<T>
+		extremes(bool maxima) const {
+			Stats<T> result(-5*_sigma, 5*_sigma, 20);
+			for (const Point& p : _points) {
+				result.add(maxima ? p.max : p.min);
+			}
+			return result;
+		}
+
+		Wave_spectrum
+		spectrum() const {
+			Wave_spectrum result;
+			const int nfreq = _welch_size/2 + 1;
+			result.segments = _segments;
+			result.frequency.resize(nfreq);
+			result.density.assign(nfreq, 0);
+			for (int k=0; k<nfreq; ++k) {
+				result.frequency[k] = k / (_welch_size*double(_zdelta(0)));
+			}
+			for (const Row& r : _rows) {
+				for (int k=0; k<nfreq; ++k) {
+					result.density[k] += r.power[k];
+				}
+			}
+			const double npoints = double(_zsize(1))*_zsize(2);
+			if (_segments > 0) {
+				// one-sided density: frequencies except 0 and Nyquist
+				// are counted twice
+				const double scale = _zdelta(0) / (_window_power*_segments*npoints);
+				for (int k=0; k<nfreq; ++k) {
+					const bool twice = k > 0 && 2*k < _welch_size;
+					result.density[k] *= scale*(twice ? 2 : 1);
+				}
+			}
+			return result;
+		}
+
+		/// Time spent on the analysis in seconds.
+		double
+		seconds() const {
+			return std::chrono::duration<double>(_time).count();
+		}
+
+		void
+		write_report(std::ostream& out) const {
+			const Stats<T> h = heights();
+			const Stats<T> p = periods();
+			const Wave_spectrum s = spectrum();
+			Point hi, lo;
+			long hi_index = 0, lo_index = 0;
+			for (size_t i=0; i<_points.size(); ++i) {
+				if (_points[i].max > _points[hi_index].max) hi_index = i;
+				if (_points[i].min < _points[lo_index].min) lo_index = i;
+			}
+			if (!_points.empty()) {
+				hi = _points[hi_index];
+				lo = _points[lo_index];
+			}
+			const int y1 = std::max(_zsize(2), 1);
+			out << "zsize=" << _zsize << '\n'
+				<< "zdelta=" << _zdelta << '\n'
+				<< "elevation\t" << elevation() << '\n'
+				<< "maximum\tvalue=" << hi.max << " t=" << hi.t_max
+				<< " x=" << hi_index / y1 << " y=" << hi_index % y1 << '\n'
+				<< "minimum\tvalue=" << lo.min << " t=" << lo.t_min
+				<< " x=" << lo_index / y1 << " y=" << lo_index % y1 << '\n'
+				<< "record_maxima\t" << extremes(true) << '\n'
+				<< "record_minima\t" << extremes(false) << '\n'
+				<< "waves\t" << h.count << '\n'
+				<< "wave_height\t" << h << '\n'
+				<< "wave_period\t" << p << '\n'
+				<< "H1/3\t" << highest_third_mean(h) << '\n'
+				<< "Hm0\t" << 4*std::sqrt(s.m0()) << '\n'
+				<< "Tp\t" << (s.peak_frequency() > 0 ? 1/s.peak_frequency() : 0.0) << '\n'
+				<< "spectrum\tsegments=" << s.segments << " size=" << _welch_size << '\n'
+				<< "# frequency\tomega\tdensity\n";
+			const double pi = 4*std::atan(1.0);
+			for (size_t k=0; k<s.frequency.size(); ++k) {
+				out << s.frequency[k] << '\t' << 2*pi*s.frequency[k]
+					<< '\t' << s.density[k] << '\n';
+			}
+			out.flush();
+		}
+
+	private:
+		/// State of the time series of one point.
+		struct Point {
+			T prev = 0;
+			T crest = 0;
+			T trough = 0;
+			/// The last zero up-crossing (-1 if there was none).
+			int t_up = -1;
+			T max = std::numeric_limits<T>::lowest();
+			T min = std::numeric_limits<T>::max();
+			int t_max = 0;
+			int t_min = 0;
+		};
+
+		/// Statistics of one row along x.
+		struct Row {
+			Row(double sigma, int nfreq):
+			elevation(-5*sigma, 5*sigma, 20),
+			heights(0, 10*sigma, 100),
+			periods(),
+			power(nfreq, 0)
+			{}
+			Stats<T> elevation;
+			Stats<T> heights;
+			Stats<T> periods;
+			/// Sum of squared magnitudes of windowed segments.
+			std::vector<double> power;
+		};
+
+		/// Layer @t completes Welch segment.
+		bool
+		segment_ends(int t) const {
+			const int hop = _welch_size/2;
+			return t + 1 >= _welch_size && (t + 1 - _welch_size) % hop == 0;
+		}
+
+		void
+		analyse_row(const Zeta<T>& slab, int t, int x,
+			std::vector<std::complex<T>>& line, std::vector<std::complex<T>>& work)
+		{
+			const int n = slab.extent(0);
+			const int y1 = slab.extent(2);
+			const long L = long(_zsize(1))*_zsize(2);
+			const T dt = _zdelta(0);
+			Row& row = _rows[x];
+			Point* points = &_points[long(x)*y1];
+			for (int i=0; i<n; ++i) {
+				const int ti = t + i;
+				const T* values = &slab(i, x, 0);
+				row.elevation.add(values, values + y1);
+				for (int y=0; y<y1; ++y) {
+					const T v = values[y];
+					Point& p = points[y];
+					if (v > p.max) { p.max = v; p.t_max = ti; }
+					if (v < p.min) { p.min = v; p.t_min = ti; }
+					if (ti > 0 && p.prev < T(0) && v >= T(0)) {
+						if (p.t_up >= 0) {
+							row.heights.add(p.crest - p.trough);
+							row.periods.add(T(ti - p.t_up)*dt);
+						}
+						p.t_up = ti;
+						p.crest = v;
+						p.trough = v;
+					} else {
+						p.crest = std::max(p.crest, v);
+						p.trough = std::min(p.trough, v);
+					}
+					p.prev = v;
+				}
+				T* ring = &_ring[(ti % _welch_size)*L + long(x)*y1];
+				std::copy_n(values, y1, ring);
+				if (segment_ends(ti)) {
+					welch_segment(ti + 1 - _welch_size, x, row, line, work);
+				}
+			}
+		}
+
+		/// Add spectra of the segment starting at @t0 of all points of row @x.
+		void
+		welch_segment(int t0, int x, Row& row,
+			std::vector<std::complex<T>>& line, std::vector<std::complex<T>>& work)
+		{
+			const int y1 = _zsize(2);
+			const long L = long(_zsize(1))*y1;
+			const int nfreq = _welch_size/2 + 1;
+			for (int y=0; y<y1; ++y) {
+				const T* base = &_ring[long(x)*y1 + y];
+				for (int i=0; i<_welch_size; ++i) {
+					line[i] = base[((t0 + i) % _welch_size)*L]*_window[i];
+				}
+				_dft.transform(line.data(), -1, work.data());
+				for (int k=0; k<nfreq; ++k) {
+					row.power[k] += std::norm(line[k]);
+				}
+			}
+		}
+
+		template<class F>
+		Stats<T>
+		merge_rows(F field) const {
+			std::vector<Stats<T>> parts;
+			for (const Row& r : _rows) {
+				parts.push_back(field(r));
+			}
+			return merge_stats(parts);
+		}
+
+		std::string _filename;
+		double _sigma;
+		int _welch_size;
+		DFT<T> _dft;
+		std::vector<T> _window;
+		double _window_power = 0;
+		size3 _zsize{0,0,0};
+		Vec3<T> _zdelta;
+		std::vector<Point> _points;
+		/// The last @_welch_size layers, layer t is at t % @_welch_size.
+		std::vector<T> _ring;
+		std::vector<Row> _rows;
+		long _segments = 0;
+		std::chrono::steady_clock::duration _time{0};
+	};
+
+}
+
+#endif // ANALYSIS_HH
@@ -4,21 +4,28 @@
 #include <algorithm>             // for min, any_of, copy_n, for_each, generate
 #include <cassert>               // for assert
 #include <chrono>                // for duration, steady_clock, steady_clock...
-#include <cmath>                 // for isnan
+#include <cmath>                 // for isnan, log, sqrt, sin, cos
 #include <cstdlib>               // for abs
 #include <functional>            // for bind
 #include <iostream>              // for operator<<, cerr, endl
+#include <limits>                // for numeric_limits
 #include <fstream>               // for ofstream
 #include <random>                // for mt19937, normal_distribution
 #include <stdexcept>             // for runtime_error
+#include <string>                // for string
 #include <vector>
-#include <thread>
 #include "parallel_mt.hh"
+#include <unistd.h>              // for sysconf
 #include <blitz/array.h>         // for Array, Range, shape, any
 
+#include "memory.hh"             // for Arena_array
+#include "parallel.hh"           // for parallel_for
+#include "pcg.hh"                // for compute_AR_coefs_pcg
+#include "separable.hh"          // for compute_AR_coefs_separable, YW_solver
+#include "stats.hh"              // for Stats
 #include "sysv.hh"               // for sysv
 #include "types.hh"              // for size3, ACF, AR_coefs, Zeta, Array2D
-#include "voodoo.hh"             // for generate_AC_matrix
+#include "voodoo.hh"             // for generate_AC_matrix, AC_matrix_order
 
 /// @file
 /// File with subroutines for AR model, Yule-Walker equations
@@ -73,11 +80,18 @@ namespace autoreg {
 
 	template<class T>
 	AR_coefs<T>
-	compute_AR_coefs(const ACF<T>& acf) {
+	compute_AR_coefs_dense(const ACF<T>& acf) {
 		using blitz::Range;
 		using blitz::toEnd;
-		const int m = acf.numElements()-1;
-		Array2D<T> acm = generate_AC_matrix(acf);
+		const int n = AC_matrix_order(acf);
+		// LAPACK computes offsets in the matrix in int
+		if (long(n)*n > std::numeric_limits<int>::max()) {
+			throw std::runtime_error("Yule-Walker matrix is too large for LAPACK, use yw_solver=pcg");
+		}
+		const int m = n-1;
+		Arena_array<T,2> acm_buffer(blitz::shape(n,n));
+		Array2D<T>& acm = acm_buffer.array();
+		generate_AC_matrix(acf, acm);
 		//{ std::ofstream out("acm"); out << acm; }
 
 		/**
@@ -89,20 +103,51 @@ namespace autoreg {
 		//{ std::ofstream out("rhs"); out << rhs; }
 
 		// lhs is the autocovariance matrix without first
-		// column and row
-		Array2D<T> lhs(blitz::shape(m,m));
-		lhs = acm(Range(1, toEnd), Range(1, toEnd));
-		//{ std::ofstream out("lhs"); out << lhs; }
-
-		assert(lhs.extent(0) == m);
-		assert(lhs.extent(1) == m);
+		// column and row, it is passed to LAPACK in place
+		// with leading dimension n
 		assert(rhs.extent(0) == m);
-		sysv<T>('U', m, 1, lhs.data(), m, rhs.data(), m);
+		sysv<T>('U', m, 1, &acm(1,1), n, rhs.data(), m);
 		AR_coefs<T> phi(acf.shape());
 		assert(phi.numElements() == rhs.numElements() + 1);
 		phi(0,0,0) = 0;
 		std::copy_n(rhs.data(), rhs.numElements(), phi.data()+1);
 		//{ std::ofstream out("ar_coefs"); out << phi; }
+		return phi;
+	}
+
+	/// Наибольшее число неизвестных, при котором матрица системы
+	/// Юла-Уокера строится явно и решается LAPACK.
+	const long max_dense_YW_size = 4096;
+
+	/// Выбор метода решения системы Юла-Уокера: для разделимой АКФ
+	/// используется разложение матрицы в кронекерово произведение,
+	/// для больших систем — метод сопряжённых градиентов.
+	template<class T>
+	YW_solver
+	choose_YW_solver(const ACF<T>& acf, YW_solver solver) {
+		if (solver == YW_AUTO) {
+			if (is_separable(acf)) {
+				solver = YW_KRONECKER;
+			} else if (long(acf.numElements()) > max_dense_YW_size) {
+				solver = YW_PCG;
+			} else {
+				solver = YW_DENSE;
+			}
+		}
+		return solver;
+	}
+
+	/// @tolerance relative residual for PCG solver.
+	template<class T>
+	AR_coefs<T>
+	compute_AR_coefs(const ACF<T>& acf, YW_solver solver = YW_AUTO, const T tolerance = T(1e-5)) {
+		solver = choose_YW_solver(acf, solver);
+		AR_coefs<T> phi;
+		switch (solver) {
+			case YW_KRONECKER: phi.reference(compute_AR_coefs_separable(acf)); break;
+			case YW_PCG: phi.reference(compute_AR_coefs_pcg(acf, tolerance)); break;
+			default: phi.reference(compute_AR_coefs_dense(acf)); break;
+		}
 		if (!is_stationary(phi)) {
 			std::cerr << "phi.shape() = " << phi.shape() << std::endl;
 			std::for_each(
@@ -125,105 +170,388 @@ namespace autoreg {
 		return std::isnan(rhs);
 	}
 
+	/// Чтение @n конфигураций генераторов, созданных программой init.
+	inline std::vector<mt_config>
+	read_mt_configs(const std::string& filename, const int n) {
+		std::ifstream init_data(filename);
+		if (!init_data.is_open()) {
+			throw std::runtime_error(filename + " not found, run ./init first");
+		}
+		std::vector<mt_config> configs(n);
+		for (mt_config& config : configs) {
+			if (!(init_data >> config)) {
+				throw std::runtime_error("not enough MT configurations in " + filename);
+			}
+		}
+		return configs;
+	}
+
+	/// Чтение всех конфигураций генераторов из файла.
+	inline std::vector<mt_config>
+	read_mt_configs(const std::string& filename) {
+		std::ifstream init_data(filename);
+		if (!init_data.is_open()) {
+			throw std::runtime_error(filename + " not found, run ./init first");
+		}
+		std::vector<mt_config> configs;
+		mt_config config;
+		while (init_data >> config) {
+			configs.push_back(config);
+		}
+		return configs;
+	}
+
+	/// Метод преобразования равномерного распределения в нормальное.
+	enum Normal_method {
+		/// Полярный метод Марсальи (std::normal_distribution).
+		NORMAL_POLAR,
+		/// Преобразование Бокса-Мюллера без отбраковки.
+		NORMAL_BOX_MULLER
+	};
+
+	inline std::istream&
+	operator>>(std::istream& in, Normal_method& rhs) {
+		std::string name;
+		in >> name;
+		if (name == "polar") rhs = NORMAL_POLAR;
+		else if (name == "box_muller") rhs = NORMAL_BOX_MULLER;
+		else throw std::runtime_error("Unknown normal distribution method: " + name);
+		return in;
+	}
+
+	inline std::ostream&
+	operator<<(std::ostream& out, Normal_method rhs) {
+		switch (rhs) {
+			case NORMAL_POLAR: out << "polar"; break;
+			case NORMAL_BOX_MULLER: out << "box_muller"; break;
+		}
+		return out;
+	}
+
+	/// Нормально распределённые числа по формулам Бокса-Мюллера,
+	/// оба числа пары используются.
+	template<class T>
+	class Box_muller {
+
+	public:
+		Box_muller(const parallel_mt& mt, T stddev):
+		_mt(mt),
+		_stddev(stddev)
+		{}
+
+		T
+		operator()() {
+			if (_has_next) {
+				_has_next = false;
+				return _next;
+			}
+			const double two_pi = 8*std::atan(1.0);
+			const double scale = 1.0 / 4294967296.0;
+			// u1 is in (0,1], so the logarithm is finite
+			const double u1 = (double(_mt()) + 1.0) * scale;
+			const double u2 = double(_mt()) * scale;
+			const double r = std::sqrt(-2*std::log(u1)) * _stddev;
+			_next = T(r*std::sin(two_pi*u2));
+			_has_next = true;
+			return T(r*std::cos(two_pi*u2));
+		}
+
+	private:
+		parallel_mt _mt;
+		T _stddev;
+		T _next = 0;
+		bool _has_next = false;
+
+		/// Состояние генератора в двоичном формате.
+		friend std::ostream&
+		operator<<(std::ostream& out, const Box_muller& rhs) {
+			out << rhs._mt;
+			out.write((const char*)&rhs._next, sizeof(T));
+			out.write((const char*)&rhs._has_next, sizeof(bool));
+			return out;
+		}
+
+		friend std::istream&
+		operator>>(std::istream& in, Box_muller& rhs) {
+			in >> rhs._mt;
+			in.read((char*)&rhs._next, sizeof(T));
+			in.read((char*)&rhs._has_next, sizeof(bool));
+			return in;
+		}
+	};
+
+	/// Заполнение @eps в пуле потоков: массив делится на равные части по
+	/// числу генераторов, каждая часть заполняется копией своего генератора
+	/// из @generators. Статистика каждой части массива вычисляется сразу
+	/// после заполнения очередного блока и объединяется в @stats
+	/// (гистограмма берётся из исходного значения @stats).
+	/// Массив с выравненными строками (padded_strides) заполняется теми же
+	/// значениями в порядке индексов, что и непрерывный.
+	template<class T, class G>
+	void
+	fill_parallel(Zeta<T>& eps, const std::vector<G>& generators, Stats<T>& stats) {
+		const bool contiguous = eps.isStorageContiguous();
+		if (!contiguous && eps.stride(2) != 1) {
+			throw std::runtime_error("white noise array is not contiguous along y");
+		}
+		const int n = generators.size();
+		const long total = eps.numElements();
+		const long x1 = eps.extent(1);
+		const long y1 = eps.extent(2);
+		T* data = eps.data();
+		// the element with row-major index @i
+		auto address = [&] (long i) {
+			if (contiguous) {
+				return data + i;
+			}
+			const long r = i / y1;
+			return data + (r / x1)*eps.stride(0) + (r % x1)*eps.stride(1) + i % y1;
+		};
+		std::vector<Stats<T>> parts(n, stats.empty());
+		parallel_for(0, n, [&] (int first, int last) {
+			const long block = 4096;
+			for (int i=first; i<last; ++i) {
+				G gen = generators[i];
+				const long end = total*(i+1)/n;
+				for (long p = total*i/n; p < end; ) {
+					long block_end = std::min(p + block, end);
+					if (!contiguous) {
+						block_end = std::min(block_end, (p / y1 + 1)*y1);
+					}
+					T* first_value = address(p);
+					T* last_value = first_value + (block_end - p);
+					for (T* q = first_value; q != last_value; ++q) {
+						*q = gen();
+					}
+					parts[i].add(first_value, last_value);
+					p = block_end;
+				}
+			}
+		});
+		stats.merge(merge_stats(parts));
+	}
+
 	/// Генерация белого шума по алгоритму Вихря Мерсенна и
-	/// преобразование его к нормальному распределению по алгоритму Бокса-Мюллера.
+	/// преобразование его к нормальному распределению методом @method.
+	/// Каждый поток использует свою конфигурацию генератора из @configs.
+	/// Шум записывается в существующий массив @eps, его статистика —
+	/// в @stats (если не пусто).
 	template<class T>
-	Zeta<T>
-	generate_white_noise(const size3& size, const T variance) {
+	void
+	generate_white_noise(
+		Zeta<T>& eps,
+		const T variance,
+		const std::vector<mt_config>& configs,
+		Normal_method method = NORMAL_POLAR,
+		Stats<T>* stats = nullptr
+	) {
 		if (variance < T(0)) {
 			throw std::runtime_error("variance is less than zero");
 		}
+		if (configs.empty()) {
+			throw std::runtime_error("no MT configurations");
+		}
 		
-		
-		int n = 8;
-        std::ifstream init_data("init_data");
-        std::vector<parallel_mt> generators;
-                        
-        for (int i = 0; i < n; i++) {
-            mt_config config;
-            init_data >> config;
-            generators.push_back(parallel_mt(config));
-        }
-   		
-   		
-        std::normal_distribution<T> normal(T(0), std::sqrt(variance));
-        
-        
-		Zeta<T> eps(size);
-        
-        
-        std::vector<std::thread> threads;
-        auto cur_begin = std::begin(eps);
-        int step = size(0) * size(1) * size(2) / n;
-        
-        
-        for (int i = 0; i < n; i++) {
-            auto cur_end = std::next(cur_begin, step);
-            auto cur_gen = std::bind(normal, generators[i]);
-            std::thread cur_thread(
-					std::generate<decltype(cur_begin), decltype(cur_gen)>, 
-					cur_begin, cur_end, 
-					cur_gen);
-					
-            threads.push_back(std::move(cur_thread));
-			cur_begin = cur_end;
-        }
-        auto cur_end = std::end(eps);
-        auto cur_gen = std::bind(normal, generators[n - 1]);
-        std::thread cur_thread(
-					std::generate<decltype(cur_begin), decltype(cur_gen)>, 
-					cur_begin, cur_end, 
-					cur_gen);
-        threads.push_back(std::move(cur_thread));
-		
-		
-		for(auto& cur_thread : threads){
-			cur_thread.join();
+		const int n = configs.size();
+		std::vector<parallel_mt> generators;
+		for (int i = 0; i < n; i++) {
+			generators.push_back(parallel_mt(configs[i]));
 		}
 		
+		const double sigma = std::sqrt(double(variance));
+		Stats<T> local(-5*sigma, 5*sigma, 20);
+		Stats<T>& result = stats ? *stats : local;
+		if (method == NORMAL_BOX_MULLER) {
+			std::vector<Box_muller<T>> gens;
+			for (int i = 0; i < n; i++) {
+				gens.emplace_back(generators[i], std::sqrt(variance));
+			}
+			fill_parallel(eps, gens, result);
+		} else {
+			std::normal_distribution<T> normal(T(0), std::sqrt(variance));
+			typedef decltype(std::bind(normal, generators[0])) generator_type;
+			std::vector<generator_type> gens;
+			for (int i = 0; i < n; i++) {
+				gens.push_back(std::bind(normal, generators[i]));
+			}
+			fill_parallel(eps, gens, result);
+		}
 		
 		//Проверка
-		if (std::any_of(std::begin(eps), std::end(eps), &::autoreg::isnan<T>)) {
+		if (result.nans > 0) {
 			throw std::runtime_error("white noise generator produced some NaNs");
 		}
+		if (result.infs > 0) {
+			throw std::runtime_error("white noise generator produced infinite values");
+		}
+	}
+
+	template<class T>
+	Zeta<T>
+	generate_white_noise(
+		const size3& size,
+		const T variance,
+		const std::vector<mt_config>& configs,
+		Normal_method method = NORMAL_POLAR
+	) {
+		Zeta<T> eps(size);
+		generate_white_noise(eps, variance, configs, method);
 		return eps;
 	}
 
-	/// Генерация отдельных частей реализации волновой поверхности.
+	/// @n число потоков (не больше числа конфигураций в файле init_data)
 	template<class T>
-	void generate_zeta(const AR_coefs<T>& phi, Zeta<T>& zeta) {
+	Zeta<T>
+	generate_white_noise(const size3& size, const T variance, const int n = 8) {
+		return generate_white_noise(size, variance, read_mt_configs("init_data", n));
+	}
+
+	/// Сумма членов АР процесса в точке (@t,@x,@y) без белого шума;
+	/// точки перед границами массива считаются нулевыми.
+	template<class T>
+	inline T
+	AR_sum(const AR_coefs<T>& phi, const Zeta<T>& zeta, int t, int x, int y) {
 		const size3 fsize = phi.shape();
+		const int m1 = std::min(t+1, fsize[0]);
+		const int m2 = std::min(x+1, fsize[1]);
+		const int m3 = std::min(y+1, fsize[2]);
+		T sum = 0;
+		for (int k=0; k<m1; k++)
+			for (int i=0; i<m2; i++)
+				for (int j=0; j<m3; j++)
+					sum += phi(k, i, j)*zeta(t-k, x-i, y-j);
+		return sum;
+	}
+
+	/// Размер (по x и y) блока точек, последние @fsize[0] слоёв которого
+	/// помещаются в половину кэша второго уровня.
+	inline int
+	zeta_tile_size(const size3& fsize, size_t element_size) {
+		long cache = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+		if (cache <= 0) {
+			cache = 256*1024;
+		}
+		const long budget = cache / 2 / (long(fsize(0))*element_size);
+		int tile = 8;
+		while (long(2*tile + fsize(1))*(2*tile + fsize(2)) <= budget) {
+			tile *= 2;
+		}
+		return tile;
+	}
+
+	/// Генерация отдельных частей реализации волновой поверхности.
+	/// Белый шум в @zeta умножается на @scale (среднеквадратичное отклонение
+	/// шума), если он был сгенерирован с единичной дисперсией.
+	/// Статистика точек с индексами не меньше @stats_offset (т.е. без
+	/// участков разгона) накапливается в @stats по мере вычисления строк.
+	/// Первые @t_begin слоёв считаются уже вычисленными (предыстория).
+	///
+	/// Плоскость x-y разбивается на блоки @tile x @tile точек (0 — размер
+	/// по кэшу, см. zeta_tile_size), и каждый блок вычисляется для всех
+	/// слоёв по времени, прежде чем перейти к следующему; тогда предыдущие
+	/// слои блока остаются в кэше. Точка зависит только от точек с не
+	/// большими индексами по всем трём осям, поэтому такой порядок даёт
+	/// тот же результат, что и обход слоёв целиком.
+	template<class T>
+	void generate_zeta(
+		const AR_coefs<T>& phi,
+		Zeta<T>& zeta,
+		const T scale = T(1),
+		Stats<T>* stats = nullptr,
+		const size3& stats_offset = size3(0,0,0),
+		const int t_begin = 0,
+		int tile = 0
+	) {
 		const size3 zsize = zeta.shape();
 		const int t1 = zsize[0];
 		const int x1 = zsize[1];
 		const int y1 = zsize[2];
-		for (int t=0; t<t1; t++) {
-			for (int x=0; x<x1; x++) {
-				for (int y=0; y<y1; y++) {
-					const int m1 = std::min(t+1, fsize[0]);
-					const int m2 = std::min(x+1, fsize[1]);
-					const int m3 = std::min(y+1, fsize[2]);
-					T sum = 0;
-					for (int k=0; k<m1; k++)
-						for (int i=0; i<m2; i++)
-							for (int j=0; j<m3; j++)
-								sum += phi(k, i, j)*zeta(t-k, x-i, y-j);
-					zeta(t, x, y) += sum;
+		if (stats && zeta.stride(2) != 1) {
+			throw std::runtime_error("zeta is not contiguous along y");
+		}
+		if (tile <= 0) {
+			tile = zeta_tile_size(phi.shape(), sizeof(T));
+		}
+		for (int x0=0; x0<x1; x0+=tile) {
+			const int x_end = std::min(x1, x0 + tile);
+			for (int y0=0; y0<y1; y0+=tile) {
+				const int y_end = std::min(y1, y0 + tile);
+				const int stats_y = std::max(y0, stats_offset[2]);
+				for (int t=t_begin; t<t1; t++) {
+					for (int x=x0; x<x_end; x++) {
+						for (int y=y0; y<y_end; y++) {
+							zeta(t, x, y) = scale*zeta(t, x, y) + AR_sum(phi, zeta, t, x, y);
+						}
+						if (stats && t >= stats_offset[0] && x >= stats_offset[1]
+							&& stats_y < y_end)
+						{
+							const T* row = &zeta(t, x, 0);
+							stats->add(row + stats_y, row + y_end);
+						}
+					}
 				}
 			}
 		}
 	}
 
+	/// Статистика всех значений массива одним проходом; части массива
+	/// обрабатываются в пуле потоков и объединяются по порядку.
+	template<class T, int N>
+	Stats<T> array_stats(const blitz::Array<T,N>& rhs) {
+		Stats<T> stats;
+		if (!rhs.isStorageContiguous()) {
+			for (const T& x : rhs) {
+				stats.add(x);
+			}
+			return stats;
+		}
+		const long block = 1L << 16;
+		const long n = rhs.numElements();
+		const int nblocks = int((n + block - 1) / block);
+		std::vector<Stats<T>> parts(nblocks);
+		const T* data = rhs.data();
+		parallel_for(0, nblocks, [&] (int first, int last) {
+			for (int i=first; i<last; ++i) {
+				parts[i].add(data + i*block, data + std::min(n, (i+1)*block));
+			}
+		});
+		return merge_stats(parts);
+	}
+
+	/// Трёхмерный массив, непрерывный по последнему измерению (например,
+	/// поверхность после trim_zeta), обрабатывается блоками строк.
+	template<class T>
+	Stats<T> array_stats(const blitz::Array<T,3>& rhs) {
+		if (rhs.isStorageContiguous() || rhs.stride(2) != 1) {
+			return array_stats<T,3>(rhs);
+		}
+		const int x1 = rhs.extent(1);
+		const int y1 = rhs.extent(2);
+		const long nrows = long(rhs.extent(0))*x1;
+		const long block = std::max(1L, (1L << 16) / std::max(y1, 1));
+		const int nblocks = int((nrows + block - 1) / block);
+		std::vector<Stats<T>> parts(nblocks);
+		parallel_for(0, nblocks, [&] (int first, int last) {
+			for (int i=first; i<last; ++i) {
+				for (long r=i*block; r<std::min(nrows, (i+1)*block); ++r) {
+					const T* row = &rhs(int(r / x1), int(r % x1), 0);
+					parts[i].add(row, row + y1);
+				}
+			}
+		});
+		return merge_stats(parts);
+	}
+
 	template<class T, int N>
 	T mean(const blitz::Array<T,N>& rhs) {
-		return blitz::sum(rhs) / rhs.numElements();
+		assert(rhs.numElements() > 0);
+		return array_stats(rhs).mean;
 	}
 
 	template<class T, int N>
 	T variance(const blitz::Array<T,N>& rhs) {
 		assert(rhs.numElements() > 0);
-		const T m = mean(rhs);
-		return blitz::sum(blitz::pow(rhs-m, 2)) / (rhs.numElements() - 1);
+		return array_stats(rhs).variance();
 	}
 
 }
@@ -9,7 +9,28 @@
 
 #include "types.hh"     // for size3, Vector, Zeta, ACF, AR_coefs
 #include "autoreg.hh"   // for mean, variance, ACF_variance, approx_acf, comp...
+#include "analysis.hh"  // for Zeta_analysis_sink
+#include "checkpoint.hh" // for Slab_generator, Noise_stream
+#include "order.hh"     // for select_AR_order, truncate_acf
+#include "parallel.hh"  // for thread_pool, Task_group
+#include "perf.hh"      // for Cache_counters
+#include "plan.hh"      // for Plan, Throughput
+#include "segments.hh"  // for generate_zeta_segmented, Full_segments, Separable_segments
+#include "shm_ring.hh"  // for Zeta_shm_sink
+#include "sink.hh"      // for Zeta_sink, Zeta_file_sink, Zeta_text_sink
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>     // for gethostname
 
 
 /// @file
@@ -25,6 +46,61 @@
 
 namespace autoreg {
 
+/// Name of the file with parameters tuned for the current host
+/// (autoreg.<hostname>.profile) that is read before autoreg.model.
+inline std::string
+profile_filename() {
+	char hostname[256] = {0};
+	if (::gethostname(hostname, sizeof(hostname)-1) != 0) {
+		return "autoreg.profile";
+	}
+	return std::string("autoreg.") + hostname + ".profile";
+}
+
+/// ACF and AR model coefficients that do not depend on surface size.
+template<class T>
+struct AR_fit {
+	ACF<T> acf;
+	AR_coefs<T> ar_coefs;
+	/// White noise variance.
+	T var_wn = 0;
+	AR_generator generator = GENERATOR_FULL;
+	/// One-dimensional filters of separable model.
+	Separable_AR<T> filters;
+};
+
+/// Thread-safe cache of AR models keyed by their parameters.
+template<class T>
+struct Fit_cache {
+
+	std::shared_ptr<const AR_fit<T>>
+	find(const std::string& key) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _fits.find(key);
+		if (it == _fits.end()) {
+			++_misses;
+			return nullptr;
+		}
+		++_hits;
+		return it->second;
+	}
+
+	void
+	insert(const std::string& key, std::shared_ptr<const AR_fit<T>> fit) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_fits[key] = fit;
+	}
+
+	size_t hits() const { return _hits; }
+	size_t misses() const { return _misses; }
+
+private:
+	std::map<std::string, std::shared_ptr<const AR_fit<T>>> _fits;
+	std::mutex _mutex;
+	std::atomic<size_t> _hits{0};
+	std::atomic<size_t> _misses{0};
+};
+
 /// Class that reads paramters from the input files,
 /// calls all subroutines, and prints the result.
 template<class T>
@@ -39,67 +115,724 @@ struct Autoreg_model {
 	zsize2(zsize)
 	{}
 
+	/// Generate wavy surface and write it to the file @output.
+	/// If @checkpoint is set, the surface is generated by slabs
+	/// with checkpoints. If @shm is set, time layers are published
+	/// in shared memory instead.
 	void act() {
-		echo_parameters();
-		std::clog << "zsize\t\tacf_size\tфункция\t\t\t\tвремя работы" << std::endl;
-		std::string beginning_of_line = "(" + std::to_string(zsize(0)) + ", " + std::to_string(zsize(1))
-                                   + ", " + std::to_string(zsize(2))
-                                   + ")\t(" + std::to_string(acf_size(0)) + ", "
-                                   + std::to_string(acf_size(1))
-                                   + ", " + std::to_string(acf_size(2)) + ")\t";
+		if (!checkpoint.empty()) {
+			prepare();
+			generate_by_slabs(nullptr);
+			return;
+		}
+		std::vector<Zeta_sink<T>*> sinks;
+		std::unique_ptr<Zeta_shm_sink<T>> shm_sink;
+		std::unique_ptr<Zeta_file_sink<T>> file_sink;
+		std::unique_ptr<Zeta_analysis_sink<T>> analysis_sink;
+		if (!shm.empty()) {
+			shm_sink.reset(new Zeta_shm_sink<T>(shm, shm_frames, shm_timeout, shm_readers));
+			sinks.push_back(shm_sink.get());
+		} else if (output != "none") {
+			file_sink.reset(new Zeta_file_sink<T>(output, binary));
+			sinks.push_back(file_sink.get());
+		}
+		if (!analysis.empty()) {
+			const ACF<T> acf = approx_acf<T>(alpha, beta, gamm, zdelta, size3(1,1,1));
+			analysis_sink.reset(new Zeta_analysis_sink<T>(analysis,
+				std::sqrt(double(acf(0,0,0))), welch_size));
+			sinks.push_back(analysis_sink.get());
+		}
+		Zeta_tee_sink<T> sink(sinks);
+		act(sink);
+		std::ostream& log = *log_stream;
+		if (shm_sink) {
+			log << beginning_of_line() << "shm\tframes=" << shm_sink->frames()
+				<< " waits=" << shm_sink->waits() << " wait_time=" << shm_sink->wait_time()
+				<< " s dropped_readers=" << shm_sink->dropped() << std::endl;
+		}
+		if (analysis_sink) {
+			const Wave_spectrum spectrum = analysis_sink->spectrum();
+			const double fp = spectrum.peak_frequency();
+			log << beginning_of_line() << "analysis\t"
+				<< long(analysis_sink->seconds()*1e3) << " ms waves="
+				<< analysis_sink->heights().count
+				<< " H1/3=" << highest_third_mean(analysis_sink->heights())
+				<< " Hm0=" << 4*std::sqrt(spectrum.m0())
+				<< " Tp=" << (fp > 0 ? 1/fp : 0.0) << std::endl;
+		}
+	}
+
+	/// Generate wavy surface and write it to @out in text format.
+	void act(std::ostream& out) {
+		Zeta_text_sink<T> sink(out);
+		act(sink);
+	}
+
+	/// Generate wavy surface and pass it to @sink by slabs of
+	/// @slab_size time layers.
+	void act(Zeta_sink<T>& sink) {
+		prepare();
+		if (_by_slabs) {
+			generate_by_slabs(&sink);
+			return;
+		}
+		std::ostream& log = *log_stream;
+		const std::string beginning_of_line = this->beginning_of_line();
                                    
 		std::chrono::steady_clock::time_point start_time;
 		std::chrono::steady_clock::time_point end_time;
 		
+		// Белый шум с единичной дисперсией не зависит от коэффициентов
+		// модели, поэтому он генерируется одновременно с решением системы
+		// Юла-Уокера, а масштабируется уже в generate_zeta.
+		const Page_faults faults0 = page_faults();
+		std::shared_ptr<const std::vector<mt_config>> configs = noise_configs();
+		// the buffer is returned to the arena and reused by the next realisation
+		// time segments require contiguous array
+		Arena_array<T,3> zeta2_buffer = padding && segments == 1
+			? Arena_array<T,3>(zsize2, padded_strides(zsize2, sizeof(T)))
+			: Arena_array<T,3>(zsize2);
+		Zeta<T>& zeta2 = zeta2_buffer.array();
+		long long noise_time = 0;
+		Stats<T> noise_stats(-5, 5, 20);
+		// the noise is a task of the pool, its parallel loop takes free
+		// workers; if all workers are busy, this thread generates the noise
+		// after fit() (or before it, if the pool has no workers)
+		Task_group noise(thread_pool());
+		noise.run([this,&noise_time,&zeta2,&noise_stats,configs] () {
+			auto t0 = std::chrono::steady_clock::now();
+			generate_white_noise(zeta2, T(1), *configs, normal, &noise_stats);
+			auto t1 = std::chrono::steady_clock::now();
+			noise_time = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+		});
+
+		std::shared_ptr<const AR_fit<T>> model;
+		{
+			// white noise takes up to noise_threads threads of the pool,
+			// LAPACK solver takes the rest
+			std::unique_ptr<Blas_threads> blas;
+			if (!fixed_threads) {
+				const int noise_share = std::min(int(parallel_threads()), int(configs->size()));
+				blas.reset(new Blas_threads(int(parallel_threads()) - noise_share));
+			}
+			model = fit();
+		}
+
 		start_time = std::chrono::steady_clock::now();
-		ACF<T> acf_model = approx_acf<T>(alpha, beta, gamm, acf_delta, acf_size);
+		noise.wait();
 		end_time = std::chrono::steady_clock::now();
 		auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "approx_acf\t" << diff << " ms" << std::endl;
-		
-		//{ std::ofstream out("acf"); out << acf_model; }
+		log << beginning_of_line <<  "generate_white_noise\t" << noise_time << " ms" << std::endl;
+		log << beginning_of_line <<  "wait_white_noise\t" << diff << " ms" << std::endl;
+		log << beginning_of_line <<  "stats[white_noise]\t" << noise_stats << std::endl;
+
+		// statistics of the surface without warm-up regions
+		const double sigma = std::sqrt(double(model->acf(0,0,0)));
+		Stats<T> zeta_stats(-5*sigma, 5*sigma, 20);
+		const size3 stats_offset = zsize2 - zsize;
+		const T scale = std::sqrt(model->var_wn);
+		// separable and segmented generators run on the workers of the pool,
+		// hence the counts are summed over all threads (in the server they
+		// include concurrent requests)
+		Cache_counters counters(true);
+		counters.start();
 		start_time = std::chrono::steady_clock::now();
-		AR_coefs<T> ar_coefs = compute_AR_coefs(acf_model);
+		if (segments > 1) {
+			const T tolerance = std::sqrt(std::numeric_limits<T>::epsilon()) * T(sigma);
+			const int length = zsize(0) / segments;
+			const size3 f = model->ar_coefs.shape();
+			const int warmup = std::max(f(0), AR_memory(model->ar_coefs, T(sigma),
+				tolerance, length, std::min(zsize2(1), 2*f(1)), std::min(zsize2(2), 2*f(2))));
+			if (warmup == length) {
+				log << "warning: AR process memory is longer than time segment, use less segments" << std::endl;
+			}
+			// seams are re-generated by the generator of the segments
+			const Seam_stats seams = model->generator == GENERATOR_SEPARABLE
+				? generate_zeta_segmented(zeta2, zsize2(0) - zsize(0), segments, warmup,
+					tolerance, Separable_segments<T>(model->filters, scale, block),
+					&zeta_stats, stats_offset)
+				: generate_zeta_segmented(zeta2, zsize2(0) - zsize(0), segments, warmup,
+					tolerance, Full_segments<T>(model->ar_coefs, scale, tile),
+					&zeta_stats, stats_offset);
+			log << beginning_of_line << "segments\t" << seams << std::endl;
+		} else if (model->generator == GENERATOR_SEPARABLE) {
+			generate_zeta_separable(model->filters, zeta2, scale, block, &zeta_stats, stats_offset);
+		} else {
+			generate_zeta(model->ar_coefs, zeta2, scale, &zeta_stats, stats_offset, 0, tile);
+		}
 		end_time = std::chrono::steady_clock::now();
+		const Cache_counts cache = counters.stop();
 		diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "compute_AR_coefs\t" << diff << " ms" << std::endl;
+		log << beginning_of_line <<  "generate_zeta[" << model->generator << "]\t" << diff << " ms" << std::endl;
+		if (counters.available()) {
+			log << beginning_of_line << "cache[generate_zeta]\t" << cache << std::endl;
+		}
+		log << beginning_of_line <<  "stats[zeta]\t" << zeta_stats << std::endl;
+		if (!zeta_stats.finite()) {
+			throw std::runtime_error("wavy surface contains NaN or infinite values");
+		}
 		
+		//std::clog << "mean(zeta) = " << mean(zeta2) << std::endl;
+		//std::clog << "variance(zeta) = " << variance(zeta2) << std::endl;
+
 		start_time = std::chrono::steady_clock::now();
-		T var_wn = white_noise_variance(ar_coefs, acf_model);
+		Zeta<T> zeta = trim_zeta(zeta2, zsize);
 		end_time = std::chrono::steady_clock::now();
 		diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "white_noise_variance\t" << diff << " ms" << std::endl;
+		log << beginning_of_line <<  "trim_zeta\t" << diff << " ms" << std::endl;
 		
-		//std::clog << "ACF variance = " << ACF_variance(acf_model) << std::endl;
-		//std::clog << "WN variance = " << var_wn << std::endl;
-
 		start_time = std::chrono::steady_clock::now();
-		Zeta<T> zeta2 = generate_white_noise(zsize2, var_wn);
+		write_zeta(sink, zeta);
 		end_time = std::chrono::steady_clock::now();
 		diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "generate_white_noise\t" << diff << " ms" << std::endl;
-		
-		//std::clog << "mean(eps) = " << mean(zeta2) << std::endl;
-		//std::clog << "variance(eps) = " << variance(zeta2) << std::endl;
+		log << beginning_of_line <<  "write_zeta\t" << diff << " ms" << std::endl;
+
+		const Page_faults faults1 = page_faults();
+		log << beginning_of_line << "memory\t" << default_arena().stats()
+			<< " minflt=" << faults1.minor - faults0.minor
+			<< " majflt=" << faults1.major - faults0.major << std::endl;
+	}
+
+	/// Generate wavy surface by time slabs of @slab_size layers keeping
+	/// only the last layers in memory and pass it to @sink. If @sink is
+	/// empty, the surface is written to @output, and the state of the
+	/// generator is written to @checkpoint every @checkpoint_interval
+	/// seconds; generation is resumed from @checkpoint if it exists.
+	/// The result is the same as the result of in-memory generation.
+	void
+	generate_by_slabs(Zeta_sink<T>* sink) {
+		using blitz::Range;
+		using blitz::toEnd;
+		std::ostream& log = *log_stream;
+		const std::string beginning_of_line = this->beginning_of_line();
+		const std::string key = checkpoint_key();
+		std::shared_ptr<const AR_fit<T>> model;
+		std::ifstream in;
+		if (!sink) {
+			in.open(checkpoint, std::ios::binary);
+		}
+		const bool resume = in.is_open();
+		std::streamoff offset = 0;
+		if (resume) {
+			std::string magic, checkpoint_key;
+			read_binary(in, magic);
+			read_binary(in, checkpoint_key);
+			if (magic != checkpoint_magic()) {
+				throw std::runtime_error(checkpoint + " is not a checkpoint");
+			}
+			if (checkpoint_key != key) {
+				throw std::runtime_error(checkpoint + " was written for other parameters");
+			}
+			read_binary(in, offset);
+			model = read_fit(in);
+		} else {
+			model = fit();
+		}
+		const long total = long(zsize2(0))*zsize2(1)*zsize2(2);
+		Slab_generator<T> generator(zsize2, model->generator, model->ar_coefs,
+			model->filters, std::sqrt(model->var_wn), block,
+			Noise_stream<T>(*noise_configs(), normal, total));
+		std::unique_ptr<Zeta_file_sink<T>> file;
+		if (resume) {
+			generator.load(in);
+			file.reset(new Zeta_file_sink<T>(output, offset, binary));
+			log << "resuming from " << checkpoint << " at time layer "
+				<< generator.position() << std::endl;
+		} else if (!sink) {
+			file.reset(new Zeta_file_sink<T>(output, binary));
+		}
+		Zeta_sink<T>& out = sink ? *sink : *file;
+		if (!resume) {
+			out.begin(zsize, zdelta);
+		}
+
+		const double sigma = std::sqrt(double(model->acf(0,0,0)));
+		Stats<T> noise_stats(-5, 5, 20);
+		Stats<T> zeta_stats(-5*sigma, 5*sigma, 20);
+		const size3 stats_offset = zsize2 - zsize;
+		const int t_offset = zsize2(0) - zsize(0);
+		std::chrono::steady_clock::duration generate_time(0), write_time(0), checkpoint_time(0);
+		auto last_checkpoint = std::chrono::steady_clock::now();
+		int ncheckpoints = 0;
+		while (generator.position() < zsize2(0)) {
+			const int t0 = generator.position();
+			const auto time0 = std::chrono::steady_clock::now();
+			const Zeta<T> slab = generator.next(slab_size, &noise_stats, &zeta_stats, stats_offset);
+			const int t1 = generator.position();
+			if (!noise_stats.finite() || !zeta_stats.finite()) {
+				throw std::runtime_error("wavy surface contains NaN or infinite values");
+			}
+			const auto time1 = std::chrono::steady_clock::now();
+			if (t1 > t_offset) {
+				const int first = std::max(t0, t_offset);
+				const Zeta<T> part = slab(Range(first - t0, t1 - t0 - 1),
+					Range(stats_offset(1), toEnd), Range(stats_offset(2), toEnd));
+				out.consume(part, first - t_offset);
+			}
+			const auto time2 = std::chrono::steady_clock::now();
+			generate_time += time1 - time0;
+			write_time += time2 - time1;
+			if (file && t1 < zsize2(0) && std::chrono::duration<double>(
+				time2 - last_checkpoint).count() >= checkpoint_interval)
+			{
+				write_checkpoint(key, *model, generator, file->sync());
+				last_checkpoint = std::chrono::steady_clock::now();
+				checkpoint_time += last_checkpoint - time2;
+				++ncheckpoints;
+			}
+		}
+		out.end();
+		if (file) {
+			std::remove(checkpoint.c_str());
+		}
+		using std::chrono::duration_cast;
+		using std::chrono::milliseconds;
+		log << beginning_of_line << "generate_zeta[" << model->generator << ",slabs]\t"
+			<< duration_cast<milliseconds>(generate_time).count() << " ms" << std::endl;
+		log << beginning_of_line << "write_zeta\t"
+			<< duration_cast<milliseconds>(write_time).count() << " ms" << std::endl;
+		if (file) {
+			log << beginning_of_line << "checkpoint[" << ncheckpoints << "]\t"
+				<< duration_cast<milliseconds>(checkpoint_time).count() << " ms" << std::endl;
+		}
+		log << beginning_of_line << "stats[white_noise]\t" << noise_stats << std::endl;
+		log << beginning_of_line << "stats[zeta]\t" << zeta_stats << std::endl;
+	}
+
+	/// Compute ACF and AR model coefficients or take them from @fit_cache
+	/// (or from the previous call with the same parameters).
+	std::shared_ptr<const AR_fit<T>>
+	fit() {
+		std::ostream& log = *log_stream;
+		const std::string beginning_of_line = this->beginning_of_line();
+		const std::string key = fit_key();
+		if (_fit && _fit_key == key) {
+			return _fit;
+		}
+		if (fit_cache) {
+			std::shared_ptr<const AR_fit<T>> cached = fit_cache->find(key);
+			if (cached) {
+				log << beginning_of_line << "compute_AR_coefs[cached]\t0 ms" << std::endl;
+				_fit = cached;
+				_fit_key = key;
+				return cached;
+			}
+		}
+
+		std::shared_ptr<AR_fit<T>> result = std::make_shared<AR_fit<T>>();
+		std::chrono::steady_clock::time_point start_time;
+		std::chrono::steady_clock::time_point end_time;
 
 		start_time = std::chrono::steady_clock::now();
-		generate_zeta(ar_coefs, zeta2);
+		ACF<T> acf_model = approx_acf<T>(alpha, beta, gamm, acf_delta, acf_size);
+		end_time = std::chrono::steady_clock::now();
+		auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+		log << beginning_of_line <<  "approx_acf\t" << diff << " ms" << std::endl;
+		
+		//{ std::ofstream out("acf"); out << acf_model; }
+		start_time = std::chrono::steady_clock::now();
+		const YW_solver solver = choose_YW_solver(acf_model, yw_solver);
+		AR_coefs<T> ar_coefs;
+		Order_stats order;
+		if (order_tolerance > T(0)) {
+			// the model of the chosen order reproduces truncated ACF
+			ar_coefs.reference(select_AR_order(acf_model, solver, order_tolerance,
+				yw_tolerance, &order));
+			acf_model.reference(truncate_acf(acf_model, order.fsize));
+		} else {
+			ar_coefs.reference(compute_AR_coefs(acf_model, solver, yw_tolerance));
+		}
 		end_time = std::chrono::steady_clock::now();
 		diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "generate_zeta\t" << diff << " ms" << std::endl;
+		log << beginning_of_line <<  "compute_AR_coefs[" << solver << "]\t" << diff << " ms" << std::endl;
+		if (yw_solver == YW_KRONECKER && !is_separable(acf_model)) {
+			log << "warning: ACF is not separable, AR coefficients are approximate" << std::endl;
+		}
 		
-		//std::clog << "mean(zeta) = " << mean(zeta2) << std::endl;
-		//std::clog << "variance(zeta) = " << variance(zeta2) << std::endl;
-
 		start_time = std::chrono::steady_clock::now();
-		Zeta<T> zeta = trim_zeta(zeta2, zsize);
+		T var_wn = white_noise_variance(ar_coefs, acf_model);
 		end_time = std::chrono::steady_clock::now();
 		diff = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-		std::clog << beginning_of_line <<  "trim_zeta\t" << diff << " ms" << std::endl;
+		log << beginning_of_line <<  "white_noise_variance\t" << diff << " ms" << std::endl;
+		if (var_wn < T(0)) {
+			throw std::runtime_error("variance is less than zero");
+		}
 		
-		write_zeta(zeta);
+		//std::clog << "ACF variance = " << ACF_variance(acf_model) << std::endl;
+		//std::clog << "WN variance = " << var_wn << std::endl;
+
+		result->generator = choose_generator(acf_model, generator);
+		if (generator == GENERATOR_SEPARABLE && result->generator != generator) {
+			log << "warning: ACF is not separable, using full AR filter" << std::endl;
+		}
+		if (result->generator == GENERATOR_SEPARABLE) {
+			result->filters = separable_AR_filters(acf_model);
+		}
+		if (order_tolerance > T(0)) {
+			// generation time is proportional to the number of coefficients
+			// for the full generator and to their sum for the separable one
+			const size3& f = order.fsize;
+			const double speedup = result->generator == GENERATOR_SEPARABLE
+				? double(acf_size(0) + acf_size(1) + acf_size(2)) / (f(0) + f(1) + f(2))
+				: double(acf_size(0))*acf_size(1)*acf_size(2) / (double(f(0))*f(1)*f(2));
+			log << beginning_of_line << "order\tfsize=" << f
+				<< " var_wn_error=" << order.var_wn_error
+				<< " residual=" << order.residual
+				<< " candidates=" << order.candidates
+				<< (order.capped ? " capped" : "")
+				<< " speedup=" << speedup << std::endl;
+		}
+		result->acf.reference(acf_model);
+		result->ar_coefs.reference(ar_coefs);
+		result->var_wn = var_wn;
+		if (fit_cache) {
+			fit_cache->insert(key, result);
+		}
+		_fit = result;
+		_fit_key = key;
+		return result;
+	}
+
+	/// Estimate memory and run time of act() from the parameters and
+	/// @throughput. If Yule-Walker solver is chosen automatically and
+	/// dense matrix exceeds @memory_budget, PCG solver is used instead.
+	/// If the surface exceeds @memory_budget, it is generated by slabs.
+	/// If @order_tolerance is set, the cost of generation depends on
+	/// the chosen order, hence the model is fitted here (and act() reuses
+	/// it instead of fitting it in parallel with white noise).
+	Plan
+	plan() {
+		validate_parameters();
+		_by_slabs = !checkpoint.empty();
+		const double budget = memory_budget*1024*1024;
+		Plan result = plan(yw_solver, _by_slabs);
+		if (memory_budget > 0 && result.peak_memory() > budget && yw_solver == YW_AUTO) {
+			Plan pcg = plan(YW_PCG, _by_slabs);
+			if (pcg.peak_memory() < result.peak_memory()) {
+				*log_stream << "warning: Yule-Walker matrix exceeds memory budget, using pcg solver" << std::endl;
+				yw_solver = YW_PCG;
+				result = pcg;
+			}
+		}
+		if (order_tolerance > T(0)) {
+			fsize = fit()->ar_coefs.shape();
+			result = plan(yw_solver, _by_slabs);
+		}
+		if (memory_budget > 0 && result.peak_memory() > budget && !_by_slabs && segments == 1) {
+			Plan slabs = plan(yw_solver, true);
+			if (slabs.peak_memory() < result.peak_memory()) {
+				*log_stream << "warning: wavy surface exceeds memory budget, generating by slabs" << std::endl;
+				_by_slabs = true;
+				result = slabs;
+			}
+		}
+		return result;
+	}
+
+	/// Throw an exception if @estimate exceeds @memory_budget or @time_budget.
+	void
+	check_budget(const Plan& estimate) const {
+		const double mb = 1024*1024;
+		if (memory_budget > 0 && estimate.peak_memory() > memory_budget*mb) {
+			std::stringstream str;
+			str << "estimated memory " << estimate.peak_memory()/mb
+				<< " MB exceeds memory_budget=" << memory_budget << " MB";
+			throw std::runtime_error(str.str());
+		}
+		if (time_budget > 0 && estimate.seconds() > time_budget) {
+			std::stringstream str;
+			str << "estimated time " << estimate.seconds()
+				<< " s exceeds time_budget=" << time_budget << " s";
+			throw std::runtime_error(str.str());
+		}
+	}
+
+	/// Measure the time of noise generation and wavy surface generation
+	/// for all combinations of thread counts, normal distribution methods,
+	/// generators and block sizes, and write the fastest one to @profile
+	/// in the format of autoreg.model.
+	void tune(std::ostream& profile) {
+		validate_parameters();
+		std::ostream& log = *log_stream;
+		echo_parameters();
+		std::shared_ptr<const AR_fit<T>> model = fit();
+		const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+		const std::vector<mt_config> all_configs = read_mt_configs("init_data");
+		log << std::left;
+
+		// white noise
+		std::vector<int> counts;
+		for (int n=1; n<=int(all_configs.size()); n*=2) {
+			counts.push_back(n);
+		}
+		if (max_threads <= int(all_configs.size()) && !is_power_of_two(max_threads)) {
+			counts.push_back(max_threads);
+		}
+		double best = std::numeric_limits<double>::max();
+		for (Normal_method method : {NORMAL_POLAR, NORMAL_BOX_MULLER}) {
+			for (int n : counts) {
+				const std::vector<mt_config> configs(all_configs.begin(), all_configs.begin() + n);
+				const double t = tune_measure([&] () {
+					generate_white_noise(zsize2, T(1), configs, method);
+				});
+				log << "generate_white_noise[" << method << ",noise_threads=" << n
+					<< "]\t" << t*1e3 << " ms" << std::endl;
+				if (t < best) {
+					best = t;
+					normal = method;
+					noise_threads = n;
+				}
+			}
+		}
+		const double points2 = double(zsize2(0))*zsize2(1)*zsize2(2);
+		throughput.noise = points2 / best;
+
+		// wavy surface
+		const Zeta<T> eps = generate_white_noise(zsize2, T(1), *noise_configs(), normal);
+		Zeta<T> zeta2(zsize2);
+		best = std::numeric_limits<double>::max();
+		std::vector<int> threads;
+		for (int n=1; n<max_threads; n*=2) {
+			threads.push_back(n);
+		}
+		threads.push_back(max_threads);
+		if (model->generator == GENERATOR_SEPARABLE) {
+			std::vector<int> blocks;
+			for (int b=8; b<zsize2(1); b*=2) {
+				blocks.push_back(b);
+			}
+			blocks.push_back(zsize2(1));
+			for (int n : threads) {
+				parallel_threads() = n;
+				for (int b : blocks) {
+					const double t = tune_measure([&] () {
+						zeta2 = eps;
+						generate_zeta_separable(model->filters, zeta2, std::sqrt(model->var_wn), b);
+					});
+					log << "generate_zeta[separable,nthreads=" << n << ",block=" << b
+						<< "]\t" << t*1e3 << " ms" << std::endl;
+					if (t < best) {
+						best = t;
+						nthreads = n;
+						block = b;
+						generator = GENERATOR_SEPARABLE;
+					}
+				}
+			}
+			throughput.separable = points2 / best;
+		}
+		// the full generator is sequential and is measured once for each
+		// tile size and layout (the last tile covers the whole plane)
+		std::vector<int> tiles;
+		for (int b=8; b<std::max(zsize2(1), zsize2(2)); b*=2) {
+			tiles.push_back(b);
+		}
+		tiles.push_back(std::max(zsize2(1), zsize2(2)));
+		double best_full = std::numeric_limits<double>::max();
+		for (bool pad : {false, true}) {
+			Arena_array<T,3> buffer = pad
+				? Arena_array<T,3>(zsize2, padded_strides(zsize2, sizeof(T)))
+				: Arena_array<T,3>(zsize2);
+			Zeta<T>& z = buffer.array();
+			for (int b : tiles) {
+				const double t = tune_measure([&] () {
+					z = eps;
+					generate_zeta(model->ar_coefs, z, std::sqrt(model->var_wn),
+						static_cast<Stats<T>*>(nullptr), size3(0,0,0), 0, b);
+				});
+				log << "generate_zeta[full,tile=" << b << ",padding=" << pad
+					<< "]\t" << t*1e3 << " ms" << std::endl;
+				if (t < best_full) {
+					best_full = t;
+					tile = b;
+					padding = pad;
+				}
+			}
+		}
+		if (best_full < best) {
+			generator = GENERATOR_FULL;
+		}
+		throughput.full = 2*points2*model->ar_coefs.numElements() / best_full;
+		parallel_threads() = nthreads > 0 ? nthreads : max_threads;
+
+		// Yule-Walker solvers on ACF of at most 1000 elements
+		// and matrix-vector product of PCG solver on the whole ACF
+		{
+			const size3 small(std::min(acf_size(0), 10), std::min(acf_size(1), 10),
+				std::min(acf_size(2), 10));
+			const ACF<T> acf = approx_acf<T>(alpha, beta, gamm, acf_delta, small);
+			const double n = double(acf.numElements());
+			const double t_sysv = tune_measure([&] () { compute_AR_coefs_dense(acf); });
+			log << "compute_AR_coefs[dense,acf_size=" << small << "]\t" << t_sysv*1e3 << " ms" << std::endl;
+			throughput.sysv = n*n*n/3 / t_sysv;
+			Multilevel_toeplitz<T> R(model->acf);
+			std::vector<T> x(R.num_elements(), T(1)), y(R.num_elements());
+			const double t_fft = tune_measure([&] () { R.multiply(x, y); });
+			double padded = 1;
+			for (int i=0; i<3; ++i) {
+				padded *= next_power_of_two(2*acf_size(i)-1);
+			}
+			throughput.fft = 10*padded*std::log2(padded) / t_fft;
+		}
+
+		// text output of the first slabs
+		{
+			const int t1 = std::min(zsize(0), 4*slab_size);
+			const Zeta<T> part = zeta2(blitz::Range(0, t1-1), blitz::Range(0, zsize(1)-1),
+				blitz::Range(0, zsize(2)-1));
+			double bytes = 0;
+			const double t_write = tune_measure([&] () {
+				std::ostringstream out;
+				Zeta_text_sink<T> sink(out);
+				write_zeta(sink, part);
+				bytes = double(out.tellp());
+			});
+			log << "write_zeta[" << t1 << " layers]\t" << t_write*1e3 << " ms" << std::endl;
+			throughput.write = bytes / t_write;
+		}
+
+		profile << "# zsize=" << zsize << " acf_size=" << acf_size << '\n';
+		profile << "nthreads=" << nthreads << '\n';
+		profile << "noise_threads=" << noise_threads << '\n';
+		profile << "normal=" << normal << '\n';
+		profile << "generator=" << generator << '\n';
+		profile << "block=" << block << '\n';
+		profile << "tile=" << tile << '\n';
+		profile << "padding=" << padding << '\n';
+		profile << "rate_noise=" << throughput.noise << '\n';
+		profile << "rate_sysv=" << throughput.sysv << '\n';
+		profile << "rate_fft=" << throughput.fft << '\n';
+		profile << "rate_full=" << throughput.full << '\n';
+		profile << "rate_separable=" << throughput.separable << '\n';
+		profile << "rate_write=" << throughput.write << '\n';
 	}
 
+	/// Output file name ("none" means that the surface is not written).
+	std::string output = "zeta";
+
+	/// Write @output in binary format (zeta_io.hh) instead of text.
+	bool binary = false;
+
+	/// File to which wave statistics and spectrum of the surface are
+	/// written (empty means no analysis).
+	std::string analysis;
+
+	/// The number of time layers of a segment of Welch's method.
+	int welch_size = 64;
+
+	/// Where timings and warnings are written.
+	std::ostream* log_stream = &std::clog;
+
+	/// MT configurations shared between runs (read from init_data if empty).
+	std::shared_ptr<const std::vector<mt_config>> mt_configs;
+
+	/// AR models shared between runs (not used if empty).
+	Fit_cache<T>* fit_cache = nullptr;
+
+	/// Process-wide thread settings (width of parallel loops and the number
+	/// of BLAS threads) are fixed by the caller and are not changed by
+	/// act(), e.g. by the server that runs several models at once.
+	bool fixed_threads = false;
+
+	/// Number of points in the generated surface.
+	double num_points() const { return double(zsize(0))*zsize(1)*zsize(2); }
+
+	/// Builder-style configuration (instead of reading autoreg.model).
+	/// Parameters are checked in act().
+	Autoreg_model& set_zsize(const size3& rhs) { zsize = rhs; return *this; }
+	Autoreg_model& set_zdelta(const Vec3<T>& rhs) { zdelta = rhs; return *this; }
+	Autoreg_model& set_acf_size(const size3& rhs) { acf_size = rhs; return *this; }
+	Autoreg_model& set_size_factor(T rhs) { _size_factor = rhs; return *this; }
+	Autoreg_model& set_alpha(T rhs) { alpha = rhs; return *this; }
+	Autoreg_model& set_beta(T rhs) { beta = rhs; return *this; }
+	Autoreg_model& set_gamma(T rhs) { gamm = rhs; return *this; }
+	Autoreg_model& set_yw_solver(YW_solver rhs) { yw_solver = rhs; return *this; }
+	Autoreg_model& set_yw_tolerance(T rhs) { yw_tolerance = rhs; return *this; }
+	Autoreg_model& set_order_tolerance(T rhs) { order_tolerance = rhs; return *this; }
+	Autoreg_model& set_generator(AR_generator rhs) { generator = rhs; return *this; }
+	Autoreg_model& set_slab_size(int rhs) { slab_size = rhs; return *this; }
+	Autoreg_model& set_nthreads(int rhs) { nthreads = rhs; return *this; }
+	Autoreg_model& set_noise_threads(int rhs) { noise_threads = rhs; return *this; }
+	Autoreg_model& set_normal(Normal_method rhs) { normal = rhs; return *this; }
+	Autoreg_model& set_block(int rhs) { block = rhs; return *this; }
+	Autoreg_model& set_tile(int rhs) { tile = rhs; return *this; }
+	Autoreg_model& set_padding(bool rhs) { padding = rhs; return *this; }
+	Autoreg_model& set_segments(int rhs) { segments = rhs; return *this; }
+	Autoreg_model& set_memory_budget(double rhs) { memory_budget = rhs; return *this; }
+	Autoreg_model& set_time_budget(double rhs) { time_budget = rhs; return *this; }
+	Autoreg_model& set_throughput(const Throughput& rhs) { throughput = rhs; return *this; }
+	Autoreg_model& set_checkpoint(const std::string& rhs) { checkpoint = rhs; return *this; }
+	Autoreg_model& set_checkpoint_interval(double rhs) { checkpoint_interval = rhs; return *this; }
+	Autoreg_model& set_shm(const std::string& rhs) { shm = rhs; return *this; }
+	Autoreg_model& set_shm_frames(int rhs) { shm_frames = rhs; return *this; }
+	Autoreg_model& set_shm_timeout(double rhs) { shm_timeout = rhs; return *this; }
+	Autoreg_model& set_shm_readers(int rhs) { shm_readers = rhs; return *this; }
+	Autoreg_model& set_output(const std::string& rhs) { output = rhs; return *this; }
+	Autoreg_model& set_binary(bool rhs) { binary = rhs; return *this; }
+	Autoreg_model& set_analysis(const std::string& rhs) { analysis = rhs; return *this; }
+	Autoreg_model& set_welch_size(int rhs) { welch_size = rhs; return *this; }
+	Autoreg_model& set_log(std::ostream& rhs) { log_stream = &rhs; return *this; }
+
+	/// Number of time layers passed to a sink at once.
+	int slab_size = 64;
+
+	/// Number of threads of parallel loops (0 means all processors).
+	int nthreads = 0;
+
+	/// Number of threads (and MT configurations) of white noise generator.
+	int noise_threads = 8;
+
+	/// Method of obtaining normally distributed white noise.
+	Normal_method normal = NORMAL_POLAR;
+
+	/// Number of rows transposed at once by separable generator.
+	int block = 64;
+
+	/// Size along x and y of blocks of points generated by the full
+	/// generator for all time layers at once (0 means the size is
+	/// chosen by L2 cache size).
+	int tile = 0;
+
+	/// Pad rows and planes of the surface the size of which is a multiple
+	/// of page size to avoid cache set conflicts (in-memory generation
+	/// without time segments only).
+	bool padding = false;
+
+	/// Number of time segments generated in parallel (1 means sequential
+	/// generation of the whole surface).
+	int segments = 1;
+
+	/// The maximal estimated memory in megabytes (0 means no limit).
+	double memory_budget = 0;
+
+	/// The maximal estimated run time in seconds (0 means no limit).
+	double time_budget = 0;
+
+	/// Throughput of the kernels measured by tune().
+	Throughput throughput;
+
+	/// File to which the state of generation by slabs is written
+	/// (empty means in-memory generation without checkpoints).
+	std::string checkpoint;
+
+	/// The minimal interval between checkpoints in seconds.
+	double checkpoint_interval = 600;
+
+	/// Name of POSIX shared memory segment to which time layers are
+	/// published (empty means output to file).
+	std::string shm;
+
+	/// The number of time layers in shared memory ring buffer.
+	int shm_frames = 256;
+
+	/// Readers that do not release frames for this number of seconds
+	/// are dropped.
+	double shm_timeout = 10;
+
+	/// The number of readers that are waited for (at most @shm_timeout
+	/// seconds) before the first time layer is published.
+	int shm_readers = 0;
+
 	/// Read AR model parameters from an input stream, generate default ACF and
 	/// validate all the parameters.
 	template<class V>
@@ -112,22 +845,51 @@ struct Autoreg_model {
 
 private:
 
-	T size_factor() const { return T(zsize2[0]) / T(zsize[0]); }
+	T size_factor() const { return _size_factor; }
 
 	/// Read AR model parameters from an input stream.
 	void
 	read_parameters(std::istream& in) {
 		std::string name;
-		T size_factor = 1.2;
 		while (std::getline(in, name, '=')) {
 			if (name.size() > 0 && name[0] == '#') in.ignore(1024*1024, '\n');
 			else if (name == "zsize"       ) in >> zsize;
 			else if (name == "zdelta"      ) in >> zdelta;
 			else if (name == "acf_size"    ) in >> acf_size;
-			else if (name == "size_factor" ) in >> size_factor;
+			else if (name == "size_factor" ) in >> _size_factor;
 			else if (name == "alpha"       ) in >> alpha;
 			else if (name == "beta"        ) in >> beta;
 			else if (name == "gamma"       ) in >> gamm;
+			else if (name == "yw_solver"   ) in >> yw_solver;
+			else if (name == "yw_tolerance") in >> yw_tolerance;
+			else if (name == "order_tolerance") in >> order_tolerance;
+			else if (name == "generator"   ) in >> generator;
+			else if (name == "output"      ) in >> output;
+			else if (name == "binary"      ) in >> binary;
+			else if (name == "slab_size"   ) in >> slab_size;
+			else if (name == "nthreads"    ) in >> nthreads;
+			else if (name == "noise_threads") in >> noise_threads;
+			else if (name == "normal"      ) in >> normal;
+			else if (name == "block"       ) in >> block;
+			else if (name == "tile"        ) in >> tile;
+			else if (name == "padding"     ) in >> padding;
+			else if (name == "segments"    ) in >> segments;
+			else if (name == "memory_budget") in >> memory_budget;
+			else if (name == "time_budget" ) in >> time_budget;
+			else if (name == "rate_noise"  ) in >> throughput.noise;
+			else if (name == "rate_sysv"   ) in >> throughput.sysv;
+			else if (name == "rate_fft"    ) in >> throughput.fft;
+			else if (name == "rate_full"   ) in >> throughput.full;
+			else if (name == "rate_separable") in >> throughput.separable;
+			else if (name == "rate_write"  ) in >> throughput.write;
+			else if (name == "checkpoint"  ) in >> checkpoint;
+			else if (name == "checkpoint_interval") in >> checkpoint_interval;
+			else if (name == "shm"         ) in >> shm;
+			else if (name == "shm_frames"  ) in >> shm_frames;
+			else if (name == "shm_timeout" ) in >> shm_timeout;
+			else if (name == "shm_readers" ) in >> shm_readers;
+			else if (name == "analysis"    ) in >> analysis;
+			else if (name == "welch_size"  ) in >> welch_size;
 			else {
 				in.ignore(1024*1024, '\n');
 				std::stringstream str;
@@ -136,20 +898,69 @@ private:
 			}
 			in >> std::ws;
 		}
+	}
 
-		if (size_factor < T(1)) {
+	/// Check for common input/logical errors and numerical implementation constraints.
+	void validate_parameters() {
+		if (_size_factor < T(1)) {
 			std::stringstream str;
-			str << "Invalid size factor: " << size_factor;
+			str << "Invalid size factor: " << _size_factor;
 			throw std::runtime_error(str.str().c_str());
 		}
+		if (slab_size < 1) {
+			throw std::runtime_error("slab_size < 1");
+		}
+		if (!(yw_tolerance > T(0))) {
+			throw std::runtime_error("yw_tolerance <= 0");
+		}
+		if (order_tolerance < T(0)) {
+			throw std::runtime_error("order_tolerance < 0");
+		}
+		if (nthreads < 0 || noise_threads < 1 || block < 1) {
+			throw std::runtime_error("nthreads < 0, noise_threads < 1 or block < 1");
+		}
+		if (segments < 1) {
+			throw std::runtime_error("segments < 1");
+		}
+		if (tile < 0) {
+			throw std::runtime_error("tile < 0");
+		}
+		if (checkpoint_interval < 0) {
+			throw std::runtime_error("checkpoint_interval < 0");
+		}
+		if (!checkpoint.empty() && segments > 1) {
+			throw std::runtime_error("checkpoints are not supported with segments > 1");
+		}
+		if (!checkpoint.empty() && !shm.empty()) {
+			throw std::runtime_error("checkpoints are not supported with shared memory output");
+		}
+		if (!checkpoint.empty() && (!analysis.empty() || output == "none")) {
+			throw std::runtime_error("checkpoints are supported only with file output without analysis");
+		}
+		if (welch_size < 4) {
+			throw std::runtime_error("welch_size < 4");
+		}
+		if (shm_frames < 1 || !(shm_timeout > 0) || shm_readers < 0 || shm_readers > shm_max_readers) {
+			throw std::runtime_error("shm_frames < 1, shm_timeout <= 0 or invalid shm_readers");
+		}
+		if (memory_budget < 0 || time_budget < 0) {
+			throw std::runtime_error("memory_budget < 0 or time_budget < 0");
+		}
+		if (!(throughput.noise > 0 && throughput.sysv > 0 && throughput.fft > 0
+			&& throughput.full > 0 && throughput.separable > 0 && throughput.write > 0))
+		{
+			throw std::runtime_error("rate_* <= 0");
+		}
 
-		zsize2 = size3(zsize*size_factor);
+		for (int i=0; i<3; ++i) {
+			if (double(zsize[i])*_size_factor > std::numeric_limits<int>::max()) {
+				throw std::runtime_error("zsize*size_factor does not fit in int");
+			}
+		}
+		zsize2 = size3(zsize*_size_factor);
 		acf_delta = zdelta;
 		fsize = acf_size;
-	}
 
-	/// Check for common input/logical errors and numerical implementation constraints.
-	void validate_parameters() {
 		check_non_zero(zsize, "zsize");
 		check_non_zero(zdelta, "zdelta");
 		check_non_zero(acf_size, "acf_size");
@@ -167,8 +978,15 @@ private:
 			tmp << "zsize[0] = " << part_sz << '\n';
 			throw std::runtime_error(tmp.str());
 		}
+		if (segments > 1 && part_sz / segments < 2*fsize_t) {
+			std::stringstream tmp;
+			tmp << "zsize[0] / segments < 2*fsize[0], use less segments\n";
+			tmp << "segments = " << segments << '\n';
+			throw std::runtime_error(tmp.str());
+		}
 	}
 
+
 	/// Check that all components of vector @sz are non-zero,
 	/// i.e. it is valid size specification.
 	template<class V>
@@ -182,12 +1000,42 @@ private:
 
 	void
 	echo_parameters() {
-		std::clog << std::left;
-		write_key_value(std::clog, "acf_size:"   , acf_size);
-		write_key_value(std::clog, "zsize:"      , zsize);
-		write_key_value(std::clog, "zsize2:"     , zsize2);
-		write_key_value(std::clog, "zdelta:"     , zdelta);
-		write_key_value(std::clog, "size_factor:", size_factor());
+		std::ostream& log = *log_stream;
+		log << std::left;
+		write_key_value(log, "acf_size:"   , acf_size);
+		write_key_value(log, "zsize:"      , zsize);
+		write_key_value(log, "zsize2:"     , zsize2);
+		write_key_value(log, "zdelta:"     , zdelta);
+		write_key_value(log, "size_factor:", size_factor());
+		write_key_value(log, "yw_solver:"  , yw_solver);
+		write_key_value(log, "yw_tolerance:", yw_tolerance);
+		if (order_tolerance > T(0)) {
+			write_key_value(log, "order_tolerance:", order_tolerance);
+		}
+		write_key_value(log, "generator:"  , generator);
+		write_key_value(log, "nthreads:"   , nthreads);
+		write_key_value(log, "noise_threads:", noise_threads);
+		write_key_value(log, "normal:"     , normal);
+		write_key_value(log, "block:"      , block);
+		write_key_value(log, "tile:"       , tile);
+		write_key_value(log, "padding:"    , padding);
+		write_key_value(log, "segments:"   , segments);
+		write_key_value(log, "binary:"     , binary);
+		write_key_value(log, "memory_budget:", memory_budget);
+		write_key_value(log, "time_budget:", time_budget);
+		if (!shm.empty()) {
+			write_key_value(log, "shm:", shm);
+			write_key_value(log, "shm_frames:", shm_frames);
+			write_key_value(log, "shm_readers:", shm_readers);
+		}
+		if (!analysis.empty()) {
+			write_key_value(log, "analysis:", analysis);
+			write_key_value(log, "welch_size:", welch_size);
+		}
+		if (!checkpoint.empty()) {
+			write_key_value(log, "checkpoint:", checkpoint);
+			write_key_value(log, "checkpoint_interval:", checkpoint_interval);
+		}
 	}
 
 	template<class V>
@@ -196,9 +1044,256 @@ private:
 		return out << std::setw(20) << key << value << std::endl;
 	}
 
-	void write_zeta(const Zeta<T>& zeta) {
-		std::ofstream out("zeta");
-		out << zeta;
+	/// Pass @zeta to @sink by slabs without copying.
+	void write_zeta(Zeta_sink<T>& sink, const Zeta<T>& zeta) {
+		using blitz::Range;
+		const int t1 = zeta.extent(0);
+		sink.begin(zeta.shape(), zdelta);
+		for (int t=0; t<t1; t+=slab_size) {
+			const int t_end = std::min(t + slab_size, t1);
+			const Zeta<T> slab = zeta(Range(t, t_end-1), Range::all(), Range::all());
+			sink.consume(slab, t);
+		}
+		sink.end();
+	}
+
+	/// MT configurations for @noise_threads threads.
+	std::shared_ptr<const std::vector<mt_config>>
+	noise_configs() const {
+		if (mt_configs && int(mt_configs->size()) >= noise_threads) {
+			if (int(mt_configs->size()) == noise_threads) {
+				return mt_configs;
+			}
+			return std::make_shared<std::vector<mt_config>>(
+				mt_configs->begin(), mt_configs->begin() + noise_threads);
+		}
+		return std::make_shared<std::vector<mt_config>>(read_mt_configs("init_data", noise_threads));
+	}
+
+	/// Estimate memory and run time of act() with Yule-Walker @solver,
+	/// either in memory or by slabs (@by_slabs).
+	/// The number of PCG iterations and the warm-up length of time
+	/// segments are not known beforehand and are estimated roughly.
+	Plan
+	plan(YW_solver solver, bool by_slabs) const {
+		const ACF<T> acf = approx_acf<T>(alpha, beta, gamm, acf_delta, acf_size);
+		solver = choose_YW_solver(acf, solver);
+		const AR_generator gen = choose_generator(acf, generator);
+		const int max_threads = nthreads > 0 ? nthreads
+			: std::max(1, int(std::thread::hardware_concurrency()));
+		const double layer = double(zsize2(1))*zsize2(2);
+		const double points2 = zsize2(0)*layer;
+		const double n = double(acf_size(0))*acf_size(1)*acf_size(2);
+		Plan result;
+		// by slabs only the last fsize[0]-1 layers and the slab are stored
+		result.resident = by_slabs
+			? (2*(fsize(0) - 1) + std::min(slab_size, zsize2(0)))*layer*sizeof(T)
+			: points2*sizeof(T);
+		// generators fill consecutive parts of the array, and a slab usually
+		// lies in the part of one generator, i.e. by slabs noise is serial
+		const double noise_parallelism = by_slabs
+			? std::max(1, std::min(noise_threads, max_threads)) : 1;
+		result.add("generate_white_noise", 0, 0,
+			points2 / throughput.noise * noise_parallelism);
+
+		// Yule-Walker equations are solved at the same time with white noise
+		double memory = 0;
+		double flops = 0;
+		double seconds = 0;
+		if (solver == YW_KRONECKER) {
+			for (int i=0; i<3; ++i) {
+				const double m = acf_size(i);
+				memory += m*m*sizeof(T);
+				flops += m*m*m/3;
+			}
+			seconds = flops / throughput.sysv;
+		} else if (solver == YW_PCG) {
+			// matrix and preconditioner are stored as eigenvalues
+			// of circulants, the first one is padded to powers of two
+			double padded = 1;
+			for (int i=0; i<3; ++i) {
+				padded *= next_power_of_two(2*acf_size(i)-1);
+			}
+			const int iterations = 50;
+			memory = (padded + n)*(sizeof(std::complex<T>) + sizeof(T)) + 6*n*sizeof(T);
+			flops = iterations*(10*padded*std::log2(padded) + 10*n*std::log2(n) + 10*n);
+			seconds = flops / throughput.fft;
+		} else {
+			// matrix and LAPACK workspace
+			memory = (n + 64)*n*sizeof(T);
+			flops = n*n*n/3;
+			seconds = flops / throughput.sysv;
+		}
+		std::stringstream name;
+		name << "compute_AR_coefs[" << solver << "]";
+		// by slabs (and if the order is chosen) white noise is generated
+		// after the model is fitted
+		result.add(name.str(), memory, flops, seconds, !by_slabs && order_tolerance <= T(0));
+
+		// generator
+		memory = 0;
+		if (gen == GENERATOR_SEPARABLE) {
+			flops = 2*points2*(fsize(0) + fsize(1) + fsize(2));
+			seconds = points2 / throughput.separable;
+		} else {
+			flops = 2*points2*fsize(0)*fsize(1)*fsize(2);
+			seconds = flops / throughput.full;
+		}
+		if (segments > 1 && !by_slabs) {
+			// warm-up as long as the trimmed part of the surface
+			const double length = zsize(0) / segments;
+			const double warmup = std::min(length, double(std::max(fsize(0), zsize2(0) - zsize(0))));
+			memory = std::min(segments, max_threads)*(length + warmup)*layer*sizeof(T)
+				+ 2*segments*warmup*layer*sizeof(T);
+			const double work = (points2 + segments*warmup*layer) / points2;
+			flops *= work;
+			seconds *= work;
+			if (gen != GENERATOR_SEPARABLE) {
+				seconds /= std::min(segments, max_threads);
+			}
+		}
+		name.str("");
+		name << "generate_zeta[" << gen << "]";
+		result.add(name.str(), memory, flops, seconds);
+
+		const double points = double(zsize(0))*zsize(1)*zsize(2);
+		if (!analysis.empty()) {
+			// the last welch_size layers and the state of each point are
+			// stored, each point is transformed in two overlapping segments
+			memory = (welch_size + 5.0)*zsize(1)*zsize(2)*sizeof(T);
+			flops = points*(20 + 10*std::log2(double(welch_size)));
+			result.add("analysis", memory, flops, flops / throughput.fft);
+		}
+		if (!shm.empty()) {
+			// layers are copied to the ring, the time depends on readers
+			memory = double(shm_frames)*zsize(1)*zsize(2)*sizeof(T);
+			result.add("write_zeta[shm]", memory, 0, 0);
+			return result;
+		}
+		if (output == "none") {
+			return result;
+		}
+		// text sink formats one slab at a time, about 11 characters a number
+		const double bytes = 11.0*points;
+		memory = 11.0*std::min(slab_size, zsize(0))*zsize(1)*zsize(2);
+		result.add("write_zeta", memory, 0, bytes / throughput.write);
+		return result;
+	}
+
+	/// Check parameters, estimate resources and write them to the log.
+	void
+	prepare() {
+		validate_parameters();
+		std::ostream& log = *log_stream;
+		// may switch Yule-Walker solver, hence before echo
+		const Plan estimate = plan();
+		echo_parameters();
+		log << "zsize\t\tacf_size\tфункция\t\t\t\tвремя работы" << std::endl;
+		log << beginning_of_line() << "plan\tmemory=" << estimate.peak_memory()/(1024*1024)
+			<< " MB time=" << estimate.seconds() << " s" << std::endl;
+		check_budget(estimate);
+		if (nthreads > 0 && !fixed_threads) {
+			parallel_threads() = nthreads;
+		}
+	}
+
+	static std::string checkpoint_magic() { return "autoreg checkpoint 1"; }
+
+	/// All parameters that the surface depends on.
+	std::string
+	checkpoint_key() const {
+		std::stringstream key;
+		key << fit_key() << zsize << zsize2 << ' ' << noise_threads << ' ' << normal
+			<< ' ' << binary << ' ' << output;
+		return key.str();
+	}
+
+	/// Write AR model, the state of @generator and @offset of the output
+	/// file to @checkpoint. The file is replaced atomically: the temporary
+	/// file is written to disk before it is renamed, and the directory
+	/// after that. The output file should be on disk up to @offset.
+	void
+	write_checkpoint(const std::string& key, const AR_fit<T>& model,
+		const Slab_generator<T>& generator, std::streamoff offset)
+	{
+		const std::string tmp = checkpoint + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::binary);
+			write_binary(out, checkpoint_magic());
+			write_binary(out, key);
+			write_binary(out, offset);
+			write_binary(out, model.acf);
+			write_binary(out, model.ar_coefs);
+			write_binary(out, model.var_wn);
+			write_binary(out, model.generator);
+			for (int i=0; i<3; ++i) {
+				write_binary(out, model.filters.filter[i]);
+			}
+			write_binary(out, model.filters.variance);
+			generator.save(out);
+			out.flush();
+			if (!out) {
+				throw std::runtime_error("unable to write " + tmp);
+			}
+		}
+		sync_file(tmp);
+		if (std::rename(tmp.c_str(), checkpoint.c_str()) != 0) {
+			throw std::runtime_error("unable to write " + checkpoint);
+		}
+		const std::string::size_type slash = checkpoint.rfind('/');
+		sync_file(slash == std::string::npos ? "." :
+			slash == 0 ? "/" : checkpoint.substr(0, slash));
+	}
+
+	std::shared_ptr<const AR_fit<T>>
+	read_fit(std::istream& in) {
+		std::shared_ptr<AR_fit<T>> result = std::make_shared<AR_fit<T>>();
+		read_binary(in, result->acf);
+		read_binary(in, result->ar_coefs);
+		read_binary(in, result->var_wn);
+		read_binary(in, result->generator);
+		for (int i=0; i<3; ++i) {
+			read_binary(in, result->filters.filter[i]);
+		}
+		read_binary(in, result->filters.variance);
+		return result;
+	}
+
+	/// The best time of several runs of @func in seconds.
+	template<class F>
+	static double
+	tune_measure(F func) {
+		double best = std::numeric_limits<double>::max();
+		double total = 0;
+		for (int i=0; i<5 && (i < 2 || total < 1.0); ++i) {
+			const auto t0 = std::chrono::steady_clock::now();
+			func();
+			const auto t1 = std::chrono::steady_clock::now();
+			const double t = std::chrono::duration<double>(t1 - t0).count();
+			best = std::min(best, t);
+			total += t;
+		}
+		return best;
+	}
+
+	std::string
+	beginning_of_line() const {
+		return "(" + std::to_string(zsize(0)) + ", " + std::to_string(zsize(1))
+			+ ", " + std::to_string(zsize(2))
+			+ ")\t(" + std::to_string(acf_size(0)) + ", "
+			+ std::to_string(acf_size(1))
+			+ ", " + std::to_string(acf_size(2)) + ")\t";
+	}
+
+	/// All parameters that AR model depends on.
+	std::string
+	fit_key() const {
+		std::stringstream key;
+		key.precision(std::numeric_limits<T>::max_digits10);
+		key << acf_size << acf_delta << ' ' << alpha << ' ' << beta << ' ' << gamm
+			<< ' ' << yw_solver << ' ' << yw_tolerance << ' ' << generator
+			<< ' ' << order_tolerance;
+		return key.str();
 	}
 
 	/// Wavy surface size.
@@ -220,12 +1315,36 @@ private:
 	/// by size_factor read from input file.
 	size3 zsize2;
 
+	T _size_factor = 1.2;
+
 	/// ACF parameters
 	/// @see approx_acf
 	T alpha = 0.06;
 	T beta = 0.8;
 	T gamm = 1.0;
 
+	/// Method of solving Yule-Walker equations
+	/// (auto, dense, kronecker or pcg).
+	YW_solver yw_solver = YW_AUTO;
+
+	/// Relative residual at which PCG iterations stop.
+	T yw_tolerance = 1e-5;
+
+	/// Relative error of white noise variance and ACF at which AR model
+	/// order is chosen (0 means fsize = acf_size).
+	T order_tolerance = 0;
+
+	/// Algorithm of wavy surface generation
+	/// (auto, full or separable).
+	AR_generator generator = GENERATOR_AUTO;
+
+	/// Generate the surface by slabs (chosen by plan()).
+	bool _by_slabs = false;
+
+	/// The last fitted model and its fit_key().
+	std::shared_ptr<const AR_fit<T>> _fit;
+	std::string _fit_key;
+
 };
 
 }
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "autoreg.hh"
+#include "memory.hh"
+#include "perf.hh"
+
+/// @file
+/// Micro-benchmarks for every stage of the programme and end-to-end
+/// sweeps over surface size, ACF size, precision and thread count.
+///
+/// Usage: autoreg_bench [-q] [-r REPS] [--baseline FILE] [--save-baseline FILE]
+///
+/// Throughput units:
+/// cells/s  number of generated surface points per second
+/// GB/s     bytes of the data produced by the stage per second
+/// GFLOP/s  estimated floating point operations per second
+
+using namespace autoreg;
+
+namespace {
+
+	typedef std::chrono::steady_clock clock_type;
+
+	int reps = 3;
+	bool quick = false;
+	std::string baseline_in;
+	std::string baseline_out;
+
+	/// Best time in seconds of the last benchmark of each kind.
+	std::map<std::string, double> results;
+	std::map<std::string, double> baseline;
+
+	/// Run @func @reps times and return the best time in seconds.
+	template<class F>
+	double
+	measure(F func) {
+		double best = 0;
+		for (int i=0; i<reps; ++i) {
+			clock_type::time_point t0 = clock_type::now();
+			func();
+			clock_type::time_point t1 = clock_type::now();
+			double s = std::chrono::duration<double>(t1 - t0).count();
+			if (i == 0 || s < best) best = s;
+		}
+		return best;
+	}
+
+	std::string
+	to_string(const size3& v) {
+		std::stringstream str;
+		str << v;
+		return str.str();
+	}
+
+	template<class T>
+	const char*
+	precision_name() {
+		return sizeof(T) == sizeof(float) ? "float" : "double";
+	}
+
+	/// Print one line of the report and compare it to the baseline.
+	void
+	report(const std::string& key, double seconds, double amount, const char* unit) {
+		results[key] = seconds;
+		std::cout << std::left << std::setw(64) << key
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(6) << seconds << " s"
+			<< std::setw(14) << std::scientific << std::setprecision(3) << amount/seconds << ' ' << unit;
+		auto it = baseline.find(key);
+		if (it != baseline.end()) {
+			const double speedup = it->second / seconds;
+			std::cout << std::fixed << std::setprecision(2) << "\tx" << speedup;
+			if (speedup < 0.9) std::cout << " REGRESSION";
+		}
+		std::cout << std::defaultfloat << std::endl;
+	}
+
+	void
+	section(const char* name) {
+		std::cout << "\n# " << name << std::endl;
+	}
+
+	size3
+	enlarged(const size3& zsize) {
+		return size3(zsize*1.4f);
+	}
+
+	template<class T>
+	ACF<T>
+	default_acf(const size3& acf_size) {
+		return approx_acf<T>(T(0.06), T(0.8), T(1), Vec3<T>(1, 1, 1), acf_size);
+	}
+
+	template<class T>
+	void
+	micro(const size3& zsize, const size3& acf_size) {
+		const std::string suffix = std::string("/") + precision_name<T>()
+			+ "/zsize=" + to_string(zsize) + "/acf=" + to_string(acf_size);
+		const size3 zsize2 = enlarged(zsize);
+		const double acf_cells = blitz::product(acf_size);
+		const double cells2 = double(zsize2(0))*zsize2(1)*zsize2(2);
+		const double m = acf_cells - 1;
+
+		ACF<T> acf;
+		double s = measure([&] () { acf.reference(default_acf<T>(acf_size)); });
+		report("approx_acf" + suffix, s, acf_cells, "cells/s");
+
+		Array2D<T> acm;
+		s = measure([&] () { acm.reference(generate_AC_matrix(acf)); });
+		report("generate_AC_matrix" + suffix, s, acf_cells*acf_cells*sizeof(T)*1e-9, "GB/s");
+
+		s = measure([&] () {
+			using blitz::Range;
+			using blitz::toEnd;
+			const int n = acf.numElements()-1;
+			Array2D<T> lhs(blitz::shape(n,n));
+			lhs = acm(Range(1, toEnd), Range(1, toEnd));
+			Array1D<T> rhs(n);
+			rhs = acm(Range(1, toEnd), 0);
+			sysv<T>('U', n, 1, lhs.data(), n, rhs.data(), n);
+		});
+		report("sysv" + suffix, s, m*m*m/3*1e-9, "GFLOP/s");
+
+		PCG_stats pcg_stats;
+		s = measure([&] () {
+			compute_AR_coefs_pcg(acf, T(1e-5), AR_coefs<T>(), &pcg_stats);
+		});
+		report("compute_AR_coefs_pcg" + suffix, s, pcg_stats.iterations, "iterations/s");
+
+		AR_coefs<T> phi = compute_AR_coefs(acf);
+		const T var_wn = white_noise_variance(phi, acf);
+
+		std::ifstream init_data("init_data");
+		mt_config config;
+		init_data >> config;
+		parallel_mt mt(config);
+		const size_t nnumbers = size_t(cells2);
+		uint32_t checksum = 0;
+		s = measure([&] () {
+			for (size_t i=0; i<nnumbers; ++i) checksum ^= mt();
+		});
+		report("parallel_mt" + suffix, s, cells2*sizeof(uint32_t)*1e-9, "GB/s");
+		if (checksum == 1) std::cout << std::flush;
+
+		Zeta<T> zeta2;
+		s = measure([&] () { zeta2.reference(generate_white_noise(zsize2, var_wn)); });
+		report("generate_white_noise" + suffix, s, cells2, "cells/s");
+
+		Zeta<T> eps(zsize2);
+		eps = zeta2;
+		s = measure([&] () {
+			zeta2 = eps;
+			generate_zeta(phi, zeta2);
+		});
+		report("generate_zeta" + suffix, s, cells2*acf_cells*2*1e-9, "GFLOP/s");
+
+		const Separable_AR<T> filters = separable_AR_filters(acf);
+		s = measure([&] () {
+			zeta2 = eps;
+			generate_zeta_separable(filters, zeta2);
+		});
+		report("generate_zeta_separable" + suffix, s, cells2, "cells/s");
+
+		Zeta<T> zeta = trim_zeta(zeta2, zsize);
+		const char* filename = "autoreg_bench.zeta";
+		s = measure([&] () {
+			std::ofstream out(filename);
+			out << zeta;
+		});
+		std::ifstream written(filename, std::ios::binary | std::ios::ate);
+		report("write_zeta" + suffix, s, double(written.tellg())*1e-9, "GB/s");
+		std::remove(filename);
+	}
+
+	/// Full generator on a surface with large power-of-two x-y plane:
+	/// traversal of whole layers, cache-sized tiles, and tiles with padded
+	/// rows and planes. Cache counts of the last run (summed over all
+	/// threads) are printed side by side if hardware counters are available.
+	template<class T>
+	void
+	tiling(const size3& zsize2, const size3& acf_size) {
+		const std::string suffix = std::string("/") + precision_name<T>()
+			+ "/zsize=" + to_string(zsize2) + "/acf=" + to_string(acf_size);
+		const double cells2 = double(zsize2(0))*zsize2(1)*zsize2(2);
+		const double acf_cells = blitz::product(acf_size);
+		const ACF<T> acf = default_acf<T>(acf_size);
+		const AR_coefs<T> phi = compute_AR_coefs_dense(acf);
+		const Zeta<T> eps = generate_white_noise(zsize2, T(1));
+		const int whole = std::max(zsize2(1), zsize2(2));
+		const int tile = zeta_tile_size(acf_size, sizeof(T));
+		struct Variant { const char* name; int tile; bool padding; };
+		const Variant variants[] = {
+			{"generate_zeta[untiled]", whole, false},
+			{"generate_zeta[tiled]", tile, false},
+			{"generate_zeta[tiled,padded]", tile, true}
+		};
+		Cache_counts caches[3];
+		for (int i=0; i<3; ++i) {
+			const Variant& v = variants[i];
+			Arena_array<T,3> buffer = v.padding
+				? Arena_array<T,3>(zsize2, padded_strides(zsize2, sizeof(T)))
+				: Arena_array<T,3>(zsize2);
+			Zeta<T>& zeta2 = buffer.array();
+			const double s = measure([&] () {
+				zeta2 = eps;
+				caches[i] = count_cache_misses([&] () {
+					generate_zeta(phi, zeta2, T(1), static_cast<Stats<T>*>(nullptr),
+						size3(0,0,0), 0, v.tile);
+				}, true);
+			});
+			report(v.name + suffix, s, cells2*acf_cells*2*1e-9, "GFLOP/s");
+		}
+		if (Cache_counters().available()) {
+			std::cout << "    " << std::setw(16) << ""
+				<< std::setw(16) << "untiled"
+				<< std::setw(16) << "tiled"
+				<< std::setw(16) << "tiled,padded" << '\n';
+			std::cout << "    " << std::setw(16) << "tile";
+			for (const Variant& v : variants) std::cout << std::setw(16) << v.tile;
+			std::cout << "\n    " << std::setw(16) << "references";
+			for (const Cache_counts& c : caches) std::cout << std::setw(16) << c.references;
+			std::cout << "\n    " << std::setw(16) << "misses";
+			for (const Cache_counts& c : caches) std::cout << std::setw(16) << c.misses;
+			std::cout << "\n    " << std::setw(16) << "l1d_misses";
+			for (const Cache_counts& c : caches) std::cout << std::setw(16) << c.l1d_misses;
+			std::cout << std::endl;
+		}
+	}
+
+	/// Run the whole programme except output and return the time in seconds.
+	template<class T>
+	double
+	end_to_end(const size3& zsize, const size3& acf_size, int nthreads) {
+		const size3 zsize2 = enlarged(zsize);
+		return measure([&] () {
+			ACF<T> acf = default_acf<T>(acf_size);
+			AR_coefs<T> phi = compute_AR_coefs(acf);
+			T var_wn = white_noise_variance(phi, acf);
+			Zeta<T> zeta2 = generate_white_noise(zsize2, var_wn, nthreads);
+			generate_zeta(phi, zeta2);
+			Zeta<T> zeta = trim_zeta(zeta2, zsize);
+		});
+	}
+
+	template<class T>
+	void
+	sweep_point(const char* name, const size3& zsize, const size3& acf_size, int nthreads) {
+		std::stringstream key;
+		key << name << '/' << precision_name<T>() << "/zsize=" << zsize
+			<< "/acf=" << acf_size << "/threads=" << nthreads;
+		const double cells = double(zsize(0))*zsize(1)*zsize(2);
+		const double s = end_to_end<T>(zsize, acf_size, nthreads);
+		report(key.str(), s, cells, "cells/s");
+	}
+
+	/// Time of the stages that run in parallel (white noise and separable
+	/// filter) with @nthreads threads. Serial stages (Yule-Walker solve,
+	/// the full filter, trimming) are excluded, otherwise the speedup would
+	/// be bounded by them.
+	template<class T>
+	double
+	parallel_stages(const size3& zsize, const size3& acf_size, int nthreads) {
+		const size3 zsize2 = enlarged(zsize);
+		const ACF<T> acf = default_acf<T>(acf_size);
+		const Separable_AR<T> filters = separable_AR_filters(acf);
+		const int old_threads = parallel_threads();
+		parallel_threads() = nthreads;
+		const double s = measure([&] () {
+			Zeta<T> zeta2 = generate_white_noise(zsize2, T(1), nthreads);
+			generate_zeta_separable(filters, zeta2);
+		});
+		parallel_threads() = old_threads;
+		return s;
+	}
+
+	/// Print speedup and parallel efficiency relative to one thread.
+	void
+	scaling_curve(const std::vector<std::string>& keys, const std::vector<int>& threads, bool weak) {
+		const double t1 = results[keys.front()];
+		for (size_t i=0; i<keys.size(); ++i) {
+			const double tn = results[keys[i]];
+			const double speedup = weak ? t1/tn*threads[i] : t1/tn;
+			std::cout << std::left << std::setw(12) << threads[i]
+				<< std::fixed << std::setprecision(2)
+				<< std::setw(12) << speedup
+				<< std::setw(12) << speedup/threads[i]
+				<< std::defaultfloat << std::endl;
+		}
+	}
+
+	void
+	read_baseline(const std::string& filename) {
+		std::ifstream in(filename);
+		if (!in.is_open()) {
+			std::cerr << "no baseline in " << filename << std::endl;
+			return;
+		}
+		std::string key;
+		double seconds;
+		while (in >> key >> seconds) {
+			baseline[key] = seconds;
+		}
+	}
+
+	void
+	write_baseline(const std::string& filename) {
+		std::ofstream out(filename);
+		out << std::setprecision(9);
+		for (const auto& pair : results) {
+			out << pair.first << '\t' << pair.second << '\n';
+		}
+	}
+
+	void
+	parse_cmdline(int argc, char** argv) {
+		for (int i=1; i<argc; ++i) {
+			const std::string ar = argv[i];
+			if (ar == "-q") quick = true;
+			else if (ar == "-r" && i+1 < argc) reps = std::max(1, std::atoi(argv[++i]));
+			else if (ar == "--baseline" && i+1 < argc) baseline_in = argv[++i];
+			else if (ar == "--save-baseline" && i+1 < argc) baseline_out = argv[++i];
+			else throw std::runtime_error("Unknown argument: " + ar);
+		}
+	}
+
+}
+
+int main(int argc, char** argv) {
+
+	parse_cmdline(argc, argv);
+	if (!std::ifstream("init_data").is_open()) {
+		std::cerr << "init_data not found, run ./init first" << std::endl;
+		return 1;
+	}
+	if (!baseline_in.empty()) {
+		read_baseline(baseline_in);
+	}
+
+	const size3 zsize = quick ? size3(250, 32, 32) : size3(1000, 32, 32);
+	const size3 acf_size(10, 10, 10);
+
+	section("stages");
+	micro<float>(zsize, acf_size);
+	micro<double>(zsize, acf_size);
+
+	section("tiling");
+	if (!Cache_counters().available()) {
+		std::cout << "cache counters are not available" << std::endl;
+	}
+	tiling<float>(quick ? size3(16, 256, 256) : size3(32, 512, 512), size3(6, 6, 6));
+
+	section("zsize sweep");
+	std::vector<size3> zsizes = {size3(250, 32, 32), size3(500, 32, 32)};
+	if (!quick) {
+		zsizes.push_back(size3(1000, 32, 32));
+		zsizes.push_back(size3(1000, 64, 64));
+	}
+	for (const size3& sz : zsizes) {
+		sweep_point<float>("zsize_sweep", sz, acf_size, 8);
+	}
+
+	section("acf_size sweep");
+	std::vector<size3> acf_sizes = {size3(4, 4, 4), size3(6, 6, 6), size3(8, 8, 8)};
+	if (!quick) {
+		acf_sizes.push_back(size3(10, 10, 10));
+		acf_sizes.push_back(size3(12, 12, 12));
+	}
+	for (const size3& sz : acf_sizes) {
+		sweep_point<float>("acf_sweep", zsize, sz, 8);
+	}
+
+	section("precision sweep");
+	sweep_point<float>("precision_sweep", zsize, acf_size, 8);
+	sweep_point<double>("precision_sweep", zsize, acf_size, 8);
+
+	const std::vector<int> threads = {1, 2, 4, 8};
+
+	// only parallel stages are measured, see parallel_stages
+	section("strong scaling (white noise, separable filter)");
+	std::vector<std::string> strong_keys;
+	for (int n : threads) {
+		std::stringstream key;
+		key << "strong[noise,separable]/float/zsize=" << zsize << "/acf=" << acf_size
+			<< "/threads=" << n;
+		const double s = parallel_stages<float>(zsize, acf_size, n);
+		report(key.str(), s, double(zsize(0))*zsize(1)*zsize(2), "cells/s");
+		strong_keys.push_back(key.str());
+	}
+	std::cout << "threads     speedup     efficiency" << std::endl;
+	scaling_curve(strong_keys, threads, false);
+
+	section("weak scaling (white noise, separable filter)");
+	std::vector<std::string> weak_keys;
+	for (int n : threads) {
+		const size3 sz(zsize(0)/8*n, zsize(1), zsize(2));
+		std::stringstream key;
+		key << "weak[noise,separable]/float/zsize=" << sz << "/acf=" << acf_size
+			<< "/threads=" << n;
+		const double s = parallel_stages<float>(sz, acf_size, n);
+		report(key.str(), s, double(sz(0))*sz(1)*sz(2), "cells/s");
+		weak_keys.push_back(key.str());
+	}
+	std::cout << "threads     speedup     efficiency" << std::endl;
+	scaling_curve(weak_keys, threads, true);
+
+	if (!baseline_out.empty()) {
+		write_baseline(baseline_out);
+		std::clog << "baseline saved to " << baseline_out << std::endl;
+	}
+	return 0;
+}
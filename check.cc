@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "autoreg.hh"
+#include "sink.hh"
+#include "zeta_io.hh"
+
+/// @file
+/// Check of 64-bit indexing on a surface of more than 2^31 points:
+/// white noise, full AR generator, trimming, statistics and binary output.
+///
+/// Usage: autoreg_check [-n POINTS]
+///
+/// The surface is mapped from a temporary file in the current directory
+/// (about 9 GB for the noise and 9 GB for the output), so that the check
+/// does not need as much RAM. Mapped pages are written back to the file
+/// by the kernel when memory is short. The directory should contain
+/// init_data.
+
+using namespace autoreg;
+
+namespace {
+
+	typedef std::chrono::steady_clock clock_type;
+
+	int failures = 0;
+
+	void
+	check(bool condition, const std::string& what) {
+		std::cout << (condition ? "ok      " : "FAILED  ") << what << std::endl;
+		if (!condition) ++failures;
+	}
+
+	bool
+	close_to(double x, double y, double tolerance) {
+		return std::abs(x - y) <= tolerance*std::max(std::abs(x), std::abs(y));
+	}
+
+	void
+	log_time(const char* stage, clock_type::time_point t0) {
+		const double s = std::chrono::duration<double>(clock_type::now() - t0).count();
+		std::cout << stage << '\t' << s << " s" << std::endl;
+	}
+
+	/// Array of @shape in the file @filename that is removed immediately
+	/// (the space is freed when the mapping is destroyed).
+	template<class T>
+	class Mapped_zeta {
+
+	public:
+		Mapped_zeta(const std::string& filename, const size3& shape):
+		_size(size_t(shape(0))*shape(1)*shape(2)*sizeof(T))
+		{
+			const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+			if (fd < 0) {
+				throw std::runtime_error("unable to create " + filename);
+			}
+			::unlink(filename.c_str());
+			if (::ftruncate(fd, _size) != 0) {
+				::close(fd);
+				throw std::runtime_error("unable to resize " + filename);
+			}
+			void* ptr = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (ptr == MAP_FAILED) {
+				throw std::runtime_error("unable to map " + filename);
+			}
+			_data = static_cast<T*>(ptr);
+			_array.reference(Zeta<T>(_data, shape, blitz::neverDeleteData));
+		}
+
+		~Mapped_zeta() {
+			::munmap(_data, _size);
+		}
+
+		Mapped_zeta(const Mapped_zeta&) = delete;
+		Mapped_zeta& operator=(const Mapped_zeta&) = delete;
+
+		Zeta<T>& array() { return _array; }
+
+	private:
+		size_t _size;
+		T* _data;
+		Zeta<T> _array;
+	};
+
+	template<class T>
+	void
+	run(long points) {
+		// x-y plane of a typical large surface, time extent is chosen
+		// so that both the enlarged and the trimmed surface have
+		// more than @points points
+		const size3 zsize(int(points / (1020L*1020L)) + 1, 1020, 1020);
+		const size3 zsize2(zsize(0) + 30, 1024, 1024);
+		const long total2 = long(zsize2(0))*zsize2(1)*zsize2(2);
+		const long total = long(zsize(0))*zsize(1)*zsize(2);
+		std::cout << "zsize2=" << zsize2 << " points=" << total2 << '\n'
+			<< "zsize=" << zsize << " points=" << total << std::endl;
+
+		Mapped_zeta<T> buffer("autoreg_check.noise", zsize2);
+		Zeta<T>& zeta2 = buffer.array();
+		// points that are not written by the generator remain NaN
+		zeta2 = std::numeric_limits<T>::quiet_NaN();
+
+		auto t0 = clock_type::now();
+		Stats<T> noise_stats(-5, 5, 20);
+		generate_white_noise(zeta2, T(1), read_mt_configs("init_data", 8),
+			NORMAL_POLAR, &noise_stats);
+		log_time("generate_white_noise", t0);
+		check(noise_stats.count == size_t(total2) && noise_stats.finite(),
+			"white noise: every point is counted");
+		check(std::abs(noise_stats.mean) < 1e-3 && std::abs(noise_stats.variance() - 1) < 1e-3,
+			"white noise: mean 0, variance 1");
+
+		t0 = clock_type::now();
+		const Stats<T> all = array_stats(zeta2);
+		log_time("array_stats", t0);
+		check(all.finite() && all.count == size_t(total2), "white noise: every point is written");
+		check(all.count == noise_stats.count && close_to(all.mean, noise_stats.mean, 1e-6)
+			&& close_to(all.variance(), noise_stats.variance(), 1e-6),
+			"array_stats of contiguous array equals noise statistics");
+
+		const ACF<T> acf = approx_acf<T>(T(0.06), T(0.8), T(1), Vec3<T>(1,1,1), size3(2,2,2));
+		const AR_coefs<T> phi = compute_AR_coefs(acf);
+		const T var_wn = white_noise_variance(phi, acf);
+		const size3 stats_offset = zsize2 - zsize;
+		Stats<T> zeta_stats;
+		t0 = clock_type::now();
+		// whole layers are traversed in order, tiles would re-read
+		// the mapped file for every tile
+		generate_zeta(phi, zeta2, std::sqrt(var_wn), &zeta_stats, stats_offset, 0,
+			std::max(zsize2(1), zsize2(2)));
+		log_time("generate_zeta", t0);
+		check(zeta_stats.count == size_t(total) && zeta_stats.finite(),
+			"generate_zeta: every point of the trimmed part is counted");
+		check(close_to(zeta_stats.variance(), acf(0,0,0), 0.05),
+			"generate_zeta: variance is close to ACF(0)");
+
+		t0 = clock_type::now();
+		const Zeta<T> zeta = trim_zeta(zeta2, zsize);
+		const Stats<T> trimmed = array_stats(zeta);
+		log_time("trim_zeta", t0);
+		check(zeta.shape()(0) == zsize(0) && zeta.shape()(1) == zsize(1)
+			&& zeta.shape()(2) == zsize(2), "trim_zeta: shape");
+		check(&zeta(zsize(0)-1, zsize(1)-1, zsize(2)-1) == &zeta2(zsize2(0)-1, zsize2(1)-1, zsize2(2)-1),
+			"trim_zeta: the last point is the last point of the enlarged surface");
+		check(trimmed.count == zeta_stats.count && close_to(trimmed.mean, zeta_stats.mean, 1e-6)
+			&& close_to(trimmed.variance(), zeta_stats.variance(), 1e-6),
+			"array_stats of trimmed surface equals generator statistics");
+
+		const std::string filename = "autoreg_check.zeta";
+		t0 = clock_type::now();
+		{
+			Zeta_file_sink<T> sink(filename, true);
+			sink.begin(zsize, Vec3<T>(1,1,1));
+			const int slab = 64;
+			for (int t=0; t<zsize(0); t+=slab) {
+				using blitz::Range;
+				const int t_end = std::min(zsize(0), t + slab);
+				sink.consume(zeta(Range(t, t_end-1), Range::all(), Range::all()), t);
+			}
+			sink.end();
+		}
+		log_time("write_zeta", t0);
+		struct stat st;
+		const bool written = ::stat(filename.c_str(), &st) == 0;
+		check(written && st.st_size == off_t(sizeof(Zeta_header) + total*sizeof(T)),
+			"binary file size is header + points*sizeof(T)");
+		if (written) {
+			Zeta_stream<T> stream(filename);
+			const int t = zsize(0)-1;
+			const auto slice = stream.slice(t);
+			const std::vector<T>& last = *slice;
+			bool same = stream.shape()(0) == zsize(0) && last.size() == size_t(zsize(1))*zsize(2);
+			for (int x=0; same && x<zsize(1); ++x) {
+				for (int y=0; y<zsize(2); ++y) {
+					same = same && last[long(x)*zsize(2) + y] == zeta(t, x, y);
+				}
+			}
+			check(same, "the last time slice of binary file equals the surface");
+		}
+		std::remove(filename.c_str());
+	}
+
+}
+
+int main(int argc, char** argv) {
+	// just over 2^31
+	long points = (1L << 31) + (1L << 20);
+	for (int i=1; i<argc; ++i) {
+		const std::string ar = argv[i];
+		if (ar == "-n" && i+1 < argc) {
+			points = std::atol(argv[++i]);
+		} else {
+			std::cerr << "usage: " << argv[0] << " [-n POINTS]" << std::endl;
+			return 1;
+		}
+	}
+	try {
+		run<float>(points);
+	} catch (const std::exception& err) {
+		std::cerr << "error: " << err.what() << std::endl;
+		return 1;
+	}
+	if (failures > 0) {
+		std::cout << failures << " checks FAILED" << std::endl;
+		return 1;
+	}
+	std::cout << "all checks passed" << std::endl;
+	return 0;
+}
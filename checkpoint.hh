@@ -0,0 +1,328 @@
+#ifndef CHECKPOINT_HH
+#define CHECKPOINT_HH
+
+#include <algorithm>             // for min, max, copy_n
+#include <istream>               // for istream
+#include <ostream>               // for ostream
+#include <random>                // for normal_distribution
+#include <sstream>               // for stringstream
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <vector>                // for vector
+
+#include "autoreg.hh"            // for Box_muller, Normal_method, generate_zeta
+#include "parallel.hh"           // for parallel_for
+#include "parallel_mt.hh"        // for parallel_mt, mt_config
+#include "separable.hh"          // for Separable_AR, separable_filter_t
+#include "stats.hh"              // for Stats, merge_stats
+#include "types.hh"              // for AR_coefs, Zeta, size3
+
+/// @file
+/// Generation of wavy surface by time slabs with checkpoints.
+///
+/// Only the last fsize[0]-1 time layers of the surface are kept between
+/// slabs, white noise of each slab is generated by the same generators
+/// and in the same order as for the whole surface, hence the result is
+/// the same as in-memory generation. The state of the generators and the
+/// last layers are written to a checkpoint from which generation is
+/// resumed after the programme is restarted.
+
+namespace autoreg {
+
+	template<class V>
+	void
+	write_binary(std::ostream& out, const V& value) {
+		out.write((const char*)&value, sizeof(V));
+	}
+
+	template<class V>
+	void
+	read_binary(std::istream& in, V& value) {
+		if (!in.read((char*)&value, sizeof(V))) {
+			throw std::runtime_error("bad checkpoint");
+		}
+	}
+
+	inline void
+	write_binary(std::ostream& out, const std::string& value) {
+		write_binary(out, long(value.size()));
+		out.write(value.data(), value.size());
+	}
+
+	inline void
+	read_binary(std::istream& in, std::string& value) {
+		long n = 0;
+		read_binary(in, n);
+		if (n < 0 || n > (1L << 20)) {
+			throw std::runtime_error("bad checkpoint");
+		}
+		value.resize(n);
+		if (!in.read(&value[0], n)) {
+			throw std::runtime_error("bad checkpoint");
+		}
+	}
+
+	template<class T, int N>
+	void
+	write_binary(std::ostream& out, const blitz::Array<T,N>& value) {
+		for (int i=0; i<N; ++i) {
+			write_binary(out, value.extent(i));
+		}
+		for (const T& x : value) {
+			write_binary(out, x);
+		}
+	}
+
+	template<class T, int N>
+	void
+	read_binary(std::istream& in, blitz::Array<T,N>& value) {
+		blitz::TinyVector<int,N> shape;
+		for (int i=0; i<N; ++i) {
+			read_binary(in, shape(i));
+			if (shape(i) < 0) {
+				throw std::runtime_error("bad checkpoint");
+			}
+		}
+		value.resize(shape);
+		for (T& x : value) {
+			read_binary(in, x);
+		}
+	}
+
+	/// White noise of the whole surface of @total values generated part
+	/// by part in the same way as generate_white_noise: the array is split
+	/// into equal parts by the number of generators, and each generator
+	/// fills its part sequentially. Hence a slab that lies in the part of
+	/// one generator is filled by one thread: MT sequence and rejection
+	/// sampling cannot be split without changing the values.
+	template<class T>
+	class Noise_stream {
+
+	public:
+		Noise_stream(const std::vector<mt_config>& configs, Normal_method method, long total):
+		_method(method),
+		_total(total)
+		{
+			if (configs.empty()) {
+				throw std::runtime_error("no MT configurations");
+			}
+			for (const mt_config& config : configs) {
+				parallel_mt mt(config);
+				if (method == NORMAL_BOX_MULLER) {
+					_box_muller.emplace_back(mt, T(1));
+				} else {
+					_polar.push_back(Polar{mt, std::normal_distribution<T>(T(0), T(1))});
+				}
+			}
+			const int n = configs.size();
+			for (int i=0; i<n; ++i) {
+				_position.push_back(total*i/n);
+			}
+		}
+
+		/// Fill @out with values [@first, @last) of the whole array
+		/// and add them to @stats. Values should be requested in order.
+		void
+		fill(T* out, long first, long last, Stats<T>* stats = nullptr) {
+			const int n = _position.size();
+			std::vector<Stats<T>> parts(n, stats ? stats->empty() : Stats<T>());
+			parallel_for(0, n, [&] (int g_begin, int g_end) {
+				for (int g=g_begin; g<g_end; ++g) {
+					const long lo = std::max(first, _total*g/n);
+					const long hi = std::min(last, _total*(g+1)/n);
+					if (lo >= hi) {
+						continue;
+					}
+					if (lo != _position[g]) {
+						throw std::runtime_error("white noise is requested out of order");
+					}
+					T* p = out + (lo - first);
+					T* end = out + (hi - first);
+					if (_method == NORMAL_BOX_MULLER) {
+						Box_muller<T>& gen = _box_muller[g];
+						for (T* q=p; q!=end; ++q) *q = gen();
+					} else {
+						Polar& gen = _polar[g];
+						for (T* q=p; q!=end; ++q) *q = gen.normal(gen.mt);
+					}
+					if (stats) {
+						parts[g].add(p, end);
+					}
+					_position[g] = hi;
+				}
+			});
+			if (stats) {
+				stats->merge(merge_stats(parts));
+			}
+		}
+
+		/// Generator states in binary format.
+		void
+		save(std::ostream& out) const {
+			for (long pos : _position) {
+				write_binary(out, pos);
+			}
+			for (const Box_muller<T>& gen : _box_muller) {
+				out << gen;
+			}
+			for (const Polar& gen : _polar) {
+				out << gen.mt;
+				// the distribution caches the second value of a pair,
+				// its text representation is exact
+				std::stringstream str;
+				str << gen.normal;
+				write_binary(out, str.str());
+			}
+		}
+
+		void
+		load(std::istream& in) {
+			for (long& pos : _position) {
+				read_binary(in, pos);
+			}
+			for (Box_muller<T>& gen : _box_muller) {
+				in >> gen;
+			}
+			for (Polar& gen : _polar) {
+				in >> gen.mt;
+				std::string text;
+				read_binary(in, text);
+				std::stringstream str(text);
+				str >> gen.normal;
+			}
+			if (!in) {
+				throw std::runtime_error("bad checkpoint");
+			}
+		}
+
+	private:
+		struct Polar {
+			parallel_mt mt;
+			std::normal_distribution<T> normal;
+		};
+
+		Normal_method _method;
+		long _total;
+		std::vector<Box_muller<T>> _box_muller;
+		std::vector<Polar> _polar;
+		/// The next value of each generator.
+		std::vector<long> _position;
+	};
+
+	/// Generates enlarged wavy surface of @zsize2 by time slabs.
+	/// AR model is defined either by coefficients @phi (full generator)
+	/// or by one-dimensional @filters (separable generator).
+	template<class T>
+	class Slab_generator {
+
+	public:
+		Slab_generator(
+			const size3& zsize2,
+			AR_generator generator,
+			const AR_coefs<T>& phi,
+			const Separable_AR<T>& filters,
+			const T scale,
+			const int block,
+			Noise_stream<T> noise
+		):
+		_zsize2(zsize2),
+		_generator(generator),
+		_phi(phi),
+		_filters(filters),
+		_scale(scale),
+		_block(block),
+		_noise(std::move(noise)),
+		_nhistory(std::max(0, (generator == GENERATOR_SEPARABLE
+			? filters.filter[0].extent(0) : phi.extent(0)) - 1)),
+		_history(long(_nhistory)*layer())
+		{}
+
+		/// The next time layer.
+		int position() const { return _t; }
+
+		/// Generate the next @n time layers. Statistics of white noise are
+		/// accumulated in @noise_stats, statistics of the points of the
+		/// surface with indices not less than @stats_offset in @zeta_stats.
+		/// The result is valid until the next call.
+		Zeta<T>
+		next(int n, Stats<T>* noise_stats = nullptr, Stats<T>* zeta_stats = nullptr,
+			const size3& stats_offset = size3(0,0,0))
+		{
+			using blitz::Range;
+			n = std::min(n, _zsize2(0) - _t);
+			if (n <= 0) {
+				throw std::runtime_error("no more time layers");
+			}
+			const long L = layer();
+			const int h = std::min(_t, _nhistory);
+			if (_buffer.extent(0) < h + n) {
+				_buffer.resize(size3(h + n, _zsize2(1), _zsize2(2)));
+			}
+			Zeta<T> buf = _buffer(Range(0, h+n-1), Range::all(), Range::all());
+			T* data = buf.data();
+			std::copy_n(_history.data() + (_nhistory - h)*L, h*L, data);
+			_noise.fill(data + h*L, _t*L, (_t + n)*L, noise_stats);
+			const size3 offset(h + std::max(0, stats_offset(0) - _t),
+				stats_offset(1), stats_offset(2));
+			// the history is taken before the filters along x and y
+			// for separable generator and after generation for the full one
+			const int nsaved = std::min(h + n, _nhistory);
+			if (_generator == GENERATOR_SEPARABLE) {
+				separable_filter_t(_filters, buf, _scale, h);
+				save_history(data, h + n, nsaved);
+				separable_filter_xy(_filters, buf, _block, zeta_stats, offset, h);
+			} else {
+				generate_zeta(_phi, buf, _scale, zeta_stats, offset, h);
+				save_history(data, h + n, nsaved);
+			}
+			_t += n;
+			return buf(Range(h, h+n-1), Range::all(), Range::all());
+		}
+
+		/// Generator state in binary format.
+		void
+		save(std::ostream& out) const {
+			write_binary(out, _t);
+			out.write((const char*)_history.data(), _history.size()*sizeof(T));
+			_noise.save(out);
+		}
+
+		void
+		load(std::istream& in) {
+			read_binary(in, _t);
+			if (_t < 0 || _t > _zsize2(0)) {
+				throw std::runtime_error("bad checkpoint");
+			}
+			in.read((char*)_history.data(), _history.size()*sizeof(T));
+			_noise.load(in);
+		}
+
+	private:
+		long layer() const { return long(_zsize2(1))*_zsize2(2); }
+
+		/// Keep the last @nsaved of @nlayers layers of @data
+		/// at the end of the history.
+		void
+		save_history(const T* data, int nlayers, int nsaved) {
+			const long L = layer();
+			std::copy_n(data + (nlayers - nsaved)*L, nsaved*L,
+				_history.data() + (_nhistory - nsaved)*L);
+		}
+
+		size3 _zsize2;
+		AR_generator _generator;
+		AR_coefs<T> _phi;
+		Separable_AR<T> _filters;
+		T _scale;
+		int _block;
+		Noise_stream<T> _noise;
+		/// The number of previous layers that the next layer depends on.
+		int _nhistory;
+		std::vector<T> _history;
+		Zeta<T> _buffer;
+		int _t = 0;
+	};
+
+}
+
+#endif // CHECKPOINT_HH
@@ -0,0 +1,211 @@
+#ifndef FFT_HH
+#define FFT_HH
+
+#include <algorithm>             // for swap
+#include <cmath>                 // for cos, sin, atan
+#include <complex>               // for complex
+#include <vector>                // for vector
+
+#include "parallel.hh"           // for parallel_for
+#include "types.hh"              // for size3
+
+/// @file
+/// Discrete Fourier transforms used by iterative Yule-Walker solver.
+///
+/// Power-of-two sizes are transformed by iterative radix-2 algorithm,
+/// other sizes by direct summation (they occur only for small
+/// preconditioner arrays).
+
+namespace autoreg {
+
+	inline bool
+	is_power_of_two(long n) {
+		return n > 0 && (n & (n-1)) == 0;
+	}
+
+	/// The smallest power of two not less than @n.
+	inline int
+	next_power_of_two(int n) {
+		int m = 1;
+		while (m < n) m <<= 1;
+		return m;
+	}
+
+	/// One-dimensional unnormalised DFT of size @n:
+	/// X(k) = sum_j x(j) exp(sign*2*pi*i*j*k/n).
+	template<class T>
+	class DFT {
+
+	public:
+		typedef std::complex<T> complex_type;
+
+		explicit
+		DFT(int n):
+		_n(n),
+		_roots(n)
+		{
+			const double pi = 4*std::atan(1.0);
+			for (int k=0; k<n; ++k) {
+				const double arg = -2*pi*k/n;
+				_roots[k] = complex_type(T(std::cos(arg)), T(std::sin(arg)));
+			}
+			if (is_power_of_two(n)) {
+				int bits = 0;
+				while ((1 << bits) < n) ++bits;
+				_reversed.resize(n);
+				for (int i=0; i<n; ++i) {
+					int r = 0;
+					for (int b=0; b<bits; ++b) {
+						if (i & (1 << b)) r |= 1 << (bits-1-b);
+					}
+					_reversed[i] = r;
+				}
+			}
+		}
+
+		int size() const { return _n; }
+
+		/// Transform contiguous array @x in place. Forward transform
+		/// has @sign = -1, inverse has @sign = 1. Array @work
+		/// of size @size() is used by direct summation.
+		void
+		transform(complex_type* x, int sign, complex_type* work) const {
+			if (_reversed.empty()) {
+				direct(x, sign, work);
+			} else {
+				radix2(x, sign);
+			}
+		}
+
+	private:
+		complex_type
+		root(long k, int sign) const {
+			const complex_type w = _roots[k % _n];
+			return sign < 0 ? w : std::conj(w);
+		}
+
+		void
+		direct(complex_type* x, int sign, complex_type* work) const {
+			for (int k=0; k<_n; ++k) {
+				T re = 0, im = 0;
+				for (int j=0; j<_n; ++j) {
+					const complex_type w = root(long(j)*k, sign);
+					re += x[j].real()*w.real() - x[j].imag()*w.imag();
+					im += x[j].real()*w.imag() + x[j].imag()*w.real();
+				}
+				work[k] = complex_type(re, im);
+			}
+			for (int k=0; k<_n; ++k) {
+				x[k] = work[k];
+			}
+		}
+
+		void
+		radix2(complex_type* x, int sign) const {
+			for (int i=0; i<_n; ++i) {
+				const int j = _reversed[i];
+				if (i < j) std::swap(x[i], x[j]);
+			}
+			for (int len=2; len<=_n; len<<=1) {
+				const int half = len/2;
+				const int step = _n/len;
+				for (int j=0; j<half; ++j) {
+					// complex product is written explicitly, because
+					// std::complex operator* checks for infinities and NaNs
+					const complex_type w = root(long(j)*step, sign);
+					const T wr = w.real();
+					const T wi = w.imag();
+					for (int i=j; i<_n; i+=len) {
+						const complex_type u = x[i];
+						const complex_type a = x[i+half];
+						const complex_type v(a.real()*wr - a.imag()*wi, a.real()*wi + a.imag()*wr);
+						x[i] = u + v;
+						x[i+half] = u - v;
+					}
+				}
+			}
+		}
+
+		int _n;
+		std::vector<complex_type> _roots;
+		std::vector<int> _reversed;
+	};
+
+	/// Three-dimensional unnormalised DFT of row-major array of size @shape.
+	template<class T>
+	class DFT_3d {
+
+	public:
+		typedef std::complex<T> complex_type;
+
+		explicit
+		DFT_3d(const size3& shape):
+		_shape(shape),
+		_dft{DFT<T>(shape(0)), DFT<T>(shape(1)), DFT<T>(shape(2))}
+		{}
+
+		const size3& shape() const { return _shape; }
+
+		long
+		num_elements() const {
+			return long(_shape(0))*_shape(1)*_shape(2);
+		}
+
+		void
+		transform(std::vector<complex_type>& x, int sign) const {
+			transform_padded(x, sign, _shape);
+		}
+
+		/// Transform array that is zero outside of [0,@nonzero),
+		/// lines that contain only zeros are skipped.
+		void
+		transform_padded(std::vector<complex_type>& x, int sign, const size3& nonzero) const {
+			transform_along(x, 2, sign, size3(nonzero(0), nonzero(1), 0));
+			transform_along(x, 1, sign, size3(nonzero(0), 0, _shape(2)));
+			transform_along(x, 0, sign, size3(0, _shape(1), _shape(2)));
+		}
+
+		/// Transform array when only [0,@needed) part of the result is used,
+		/// lines that do not contribute to this part are skipped.
+		void
+		transform_truncated(std::vector<complex_type>& x, int sign, const size3& needed) const {
+			transform_along(x, 0, sign, size3(0, _shape(1), _shape(2)));
+			transform_along(x, 1, sign, size3(needed(0), 0, _shape(2)));
+			transform_along(x, 2, sign, size3(needed(0), needed(1), 0));
+		}
+
+	private:
+		/// Transform lines along dimension @dim with the other two indices
+		/// less than @limit. Lines are gathered into contiguous buffer.
+		void
+		transform_along(std::vector<complex_type>& x, int dim, int sign, const size3& limit) const {
+			const int n = _shape(dim);
+			const int a = dim == 0 ? 1 : 0;
+			const int b = dim == 2 ? 1 : 2;
+			const long strides[3] = {long(_shape(1))*_shape(2), _shape(2), 1};
+			const long stride = strides[dim];
+			const int nb = limit(b);
+			const long nlines = long(limit(a))*nb;
+			auto func = [&] (int first, int last) {
+				std::vector<complex_type> line(n), work(n);
+				for (long l=first; l<last; ++l) {
+					complex_type* base = &x[(l / nb)*strides[a] + (l % nb)*strides[b]];
+					for (int i=0; i<n; ++i) line[i] = base[i*stride];
+					_dft[dim].transform(line.data(), sign, work.data());
+					for (int i=0; i<n; ++i) base[i*stride] = line[i];
+				}
+			};
+			if (nlines*n < (1L << 16)) {
+				func(0, int(nlines));
+			} else {
+				parallel_for(0, int(nlines), func);
+			}
+		}
+
+		size3 _shape;
+		DFT<T> _dft[3];
+	};
+
+}
+
+#endif // FFT_HH
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallel.hh"
+#include "types.hh"
+#include "zeta_io.hh"
+
+/// @file
+/// Headless renderer that converts every time slice of the wavy surface
+/// into an image (shaded height map or wireframe) without OpenGL.
+/// Frames are rendered in parallel and written as a numbered sequence.
+///
+/// Usage: frames [-m heightmap|wireframe] [-f ppm|png] [-s scale]
+///               [-o prefix] [-j threads] [-t first] [-n count] [zeta]
+
+using namespace autoreg;
+
+typedef float Real;
+
+enum Render_mode {
+	RENDER_HEIGHTMAP,
+	RENDER_WIREFRAME
+};
+
+enum Image_format {
+	FORMAT_PPM,
+	FORMAT_PNG
+};
+
+Zeta<Real> func;
+Vector<Real,3> delta(1,1,1);
+Render_mode mode = RENDER_HEIGHTMAP;
+Image_format format = FORMAT_PPM;
+int scale = 4;          // пикселей на ячейку сетки
+std::string prefix = "frame_";
+int nthreads = std::max(1u, std::thread::hardware_concurrency());
+int first_frame = 0;
+int nframes = -1;
+Real amplitude = 1;     // 3 стандартных отклонения поверхности
+
+/// RGB image with 8 bits per channel.
+struct Image {
+
+	Image(int w, int h, uint8_t background):
+	width(w), height(h), pixels(3*w*h, background)
+	{}
+
+	void
+	set(int x, int y, const uint8_t rgb[3]) {
+		if (x < 0 || y < 0 || x >= width || y >= height) return;
+		uint8_t* p = &pixels[3*(y*width + x)];
+		p[0] = rgb[0]; p[1] = rgb[1]; p[2] = rgb[2];
+	}
+
+	/// Bresenham's line.
+	void
+	line(int x0, int y0, int x1, int y1, const uint8_t rgb[3]) {
+		const int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+		const int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+		int err = dx + dy;
+		while (true) {
+			set(x0, y0, rgb);
+			if (x0 == x1 && y0 == y1) break;
+			const int e2 = 2*err;
+			if (e2 >= dy) { err += dy; x0 += sx; }
+			if (e2 <= dx) { err += dx; y0 += sy; }
+		}
+	}
+
+	int width;
+	int height;
+	std::vector<uint8_t> pixels;
+};
+
+/// Bilinear interpolation of grid function @f of the size of a time slice.
+template<class F>
+Real
+interpolate(F f, Real x, Real y) {
+	const int x1 = func.extent(1) - 1;
+	const int y1 = func.extent(2) - 1;
+	const int i = std::min(int(x), std::max(x1 - 1, 0));
+	const int j = std::min(int(y), std::max(y1 - 1, 0));
+	const Real fx = std::min(x - i, Real(1));
+	const Real fy = std::min(y - j, Real(1));
+	const int i1 = std::min(i + 1, x1);
+	const int j1 = std::min(j + 1, y1);
+	return (1-fx)*(1-fy)*f(i, j) + fx*(1-fy)*f(i1, j)
+		+ (1-fx)*fy*f(i, j1) + fx*fy*f(i1, j1);
+}
+
+/// Shaded height map: colour encodes elevation, brightness encodes
+/// the angle between the surface normal and the light direction.
+/// Slopes are computed in grid nodes and interpolated between them.
+Image
+render_heightmap(int t) {
+	const int x1 = func.extent(1);
+	const int y1 = func.extent(2);
+	Array2D<Real> dzdx(x1, y1), dzdy(x1, y1);
+	for (int i=0; i<x1; ++i) {
+		for (int j=0; j<y1; ++j) {
+			const int i0 = std::max(i-1, 0), i1 = std::min(i+1, x1-1);
+			const int j0 = std::max(j-1, 0), j1 = std::min(j+1, y1-1);
+			dzdx(i, j) = (func(t, i1, j) - func(t, i0, j)) / (std::max(i1-i0, 1)*delta[1]);
+			dzdy(i, j) = (func(t, i, j1) - func(t, i, j0)) / (std::max(j1-j0, 1)*delta[2]);
+		}
+	}
+	auto z = [t] (int i, int j) { return func(t, i, j); };
+	auto gx = [&dzdx] (int i, int j) { return dzdx(i, j); };
+	auto gy = [&dzdy] (int i, int j) { return dzdy(i, j); };
+	Image img(y1*scale, x1*scale, 0);
+	const Real light[3] = {-0.5, -0.5, 0.7071};
+	for (int py=0; py<img.height; ++py) {
+		for (int px=0; px<img.width; ++px) {
+			const Real x = Real(py) / scale;
+			const Real y = Real(px) / scale;
+			const Real sx = interpolate(gx, x, y);
+			const Real sy = interpolate(gy, x, y);
+			const Real norm = std::sqrt(sx*sx + sy*sy + 1);
+			const Real lambert = std::max(Real(0),
+				(-sx*light[0] - sy*light[1] + light[2]) / norm);
+			const Real shade = Real(0.35) + Real(0.65)*lambert;
+			// от глубокой синей впадины до белого гребня
+			const Real h = interpolate(z, x, y);
+			const Real s = std::max(Real(0), std::min(Real(1), (h/amplitude + 1) / 2));
+			const uint8_t rgb[3] = {
+				uint8_t(std::min(Real(255), shade*(10 + 235*s*s))),
+				uint8_t(std::min(Real(255), shade*(50 + 195*s))),
+				uint8_t(std::min(Real(255), shade*(110 + 145*s)))
+			};
+			img.set(px, py, rgb);
+		}
+	}
+	return img;
+}
+
+/// Wireframe viewed from above at 30 degrees like in the visual programme.
+Image
+render_wireframe(int t) {
+	const int x1 = func.extent(1);
+	const int y1 = func.extent(2);
+	const Real angle = Real(30) * Real(3.14159265) / Real(180);
+	const Real ca = std::cos(angle);
+	const Real sa = std::sin(angle);
+	const Real zscale = Real(x1) * scale / 16 / amplitude;
+	const int margin = int(std::ceil(amplitude * zscale * ca)) + 2;
+	Image img(y1*scale + 2, int(x1*scale*sa) + 2*margin, 64);
+	const uint8_t rgb[3] = {217, 217, 217};
+	auto u = [&] (int j) { return 1 + j*scale; };
+	auto v = [&] (int i, int j) {
+		return margin + int((x1 - 1 - i)*scale*sa - func(t, i, j)*zscale*ca);
+	};
+	for (int i=0; i<x1; ++i) {
+		for (int j=0; j<y1; ++j) {
+			if (j+1 < y1) img.line(u(j), v(i,j), u(j+1), v(i,j+1), rgb);
+			if (i+1 < x1) img.line(u(j), v(i,j), u(j), v(i+1,j), rgb);
+		}
+	}
+	return img;
+}
+
+void
+write_ppm(std::ostream& out, const Image& img) {
+	out << "P6\n" << img.width << ' ' << img.height << "\n255\n";
+	out.write((const char*)img.pixels.data(), img.pixels.size());
+}
+
+uint32_t
+crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+	static const std::vector<uint32_t> table = [] () {
+		std::vector<uint32_t> tbl(256);
+		for (uint32_t i=0; i<256; ++i) {
+			uint32_t c = i;
+			for (int k=0; k<8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			tbl[i] = c;
+		}
+		return tbl;
+	}();
+	crc = ~crc;
+	for (size_t i=0; i<n; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+void
+put_u32(std::vector<uint8_t>& buf, uint32_t x) {
+	buf.push_back(x >> 24); buf.push_back(x >> 16); buf.push_back(x >> 8); buf.push_back(x);
+}
+
+void
+write_png_chunk(std::ostream& out, const char* type, const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> chunk;
+	put_u32(chunk, data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	put_u32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+	out.write((const char*)chunk.data(), chunk.size());
+}
+
+/// PNG with uncompressed (stored) deflate blocks, so that no zlib is needed.
+void
+write_png(std::ostream& out, const Image& img) {
+	static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	out.write((const char*)signature, 8);
+	std::vector<uint8_t> header;
+	put_u32(header, img.width);
+	put_u32(header, img.height);
+	const uint8_t rest[5] = {8, 2, 0, 0, 0}; // 8 bit RGB
+	header.insert(header.end(), rest, rest + 5);
+	write_png_chunk(out, "IHDR", header);
+	const size_t row = 3*img.width;
+	std::vector<uint8_t> raw;
+	raw.reserve((row + 1)*img.height);
+	for (int y=0; y<img.height; ++y) {
+		raw.push_back(0); // no filter
+		raw.insert(raw.end(), &img.pixels[y*row], &img.pixels[y*row] + row);
+	}
+	std::vector<uint8_t> z = {0x78, 0x01};
+	uint32_t a = 1, b = 0;
+	for (uint8_t c : raw) { a = (a + c) % 65521; b = (b + a) % 65521; }
+	size_t pos = 0;
+	do {
+		const size_t n = std::min(raw.size() - pos, size_t(65535));
+		z.push_back(pos + n == raw.size() ? 1 : 0);
+		z.push_back(n & 0xff); z.push_back(n >> 8);
+		z.push_back(~n & 0xff); z.push_back((~n >> 8) & 0xff);
+		z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+		pos += n;
+	} while (pos < raw.size());
+	put_u32(z, (b << 16) | a);
+	write_png_chunk(out, "IDAT", z);
+	write_png_chunk(out, "IEND", std::vector<uint8_t>());
+}
+
+void
+write_frame(int t) {
+	Image img = mode == RENDER_HEIGHTMAP ? render_heightmap(t) : render_wireframe(t);
+	char name[32];
+	std::snprintf(name, sizeof(name), "%06d.%s", t, format == FORMAT_PPM ? "ppm" : "png");
+	std::ofstream out(prefix + name, std::ios::binary);
+	if (!out.is_open()) {
+		throw std::runtime_error("unable to write " + prefix + name);
+	}
+	if (format == FORMAT_PPM) write_ppm(out, img);
+	else write_png(out, img);
+}
+
+/// Frames are split into several ranges per thread of the pool that are
+/// taken dynamically, so that slow frames do not stall the others.
+void
+render_frames(int first, int last) {
+	parallel_for(first, last, [] (int t0, int t1) {
+		for (int t=t0; t<t1; ++t) {
+			write_frame(t);
+		}
+	}, nthreads);
+}
+
+void
+parse_cmdline(int argc, char** argv) {
+	using namespace std;
+	stringstream cmdline;
+	for (int i=1; i<argc; i++)
+		cmdline << argv[i] << ' ';
+	string file_name;
+	string ar;
+	while (!(cmdline >> ar).eof()) {
+		if (ar == "-m") {
+			cmdline >> ar;
+			if (ar == "heightmap") mode = RENDER_HEIGHTMAP;
+			else if (ar == "wireframe") mode = RENDER_WIREFRAME;
+			else throw runtime_error("unknown render mode: " + ar);
+		}
+		else if (ar == "-f") {
+			cmdline >> ar;
+			if (ar == "ppm") format = FORMAT_PPM;
+			else if (ar == "png") format = FORMAT_PNG;
+			else throw runtime_error("unknown image format: " + ar);
+		}
+		else if (ar == "-s") cmdline >> scale;
+		else if (ar == "-o") cmdline >> prefix;
+		else if (ar == "-j") cmdline >> nthreads;
+		else if (ar == "-t") cmdline >> first_frame;
+		else if (ar == "-n") cmdline >> nframes;
+		else file_name = ar;
+		cmdline >> ws;
+	}
+	scale = max(scale, 1);
+	nthreads = max(nthreads, 1);
+	// the pool is created on first use (when the file is parsed)
+	parallel_threads() = nthreads;
+	if (!file_name.empty()) {
+		clog << "reading " << file_name << endl;
+		func.reference(read_zeta<Real>(file_name));
+	} else {
+		cin >> func;
+	}
+}
+
+int main(int argc, char** argv) {
+	try {
+		parse_cmdline(argc, argv);
+		if (func.numElements() == 0) {
+			std::cerr << "empty surface" << std::endl;
+			return 1;
+		}
+		const Real n = func.numElements();
+		const Real mean = blitz::sum(func) / n;
+		const Real var = blitz::sum(blitz::pow(func - mean, 2)) / n;
+		amplitude = std::max(Real(3)*std::sqrt(var), Real(1e-6));
+		const int nt = func.extent(0);
+		const int first = std::min(std::max(first_frame, 0), nt);
+		const int last = nframes < 0 ? nt : std::min(nt, first + nframes);
+		render_frames(first, last);
+		std::clog << "written " << last - first << " frames" << std::endl;
+	} catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include "parallel_mt.hh"
@@ -6,8 +7,13 @@
 
 using namespace autoreg;
 
-int main(){
-    int n = 8;
+/// Usage: init [number of configurations, default 8]
+int main(int argc, char* argv[]){
+    int n = argc > 1 ? std::atoi(argv[1]) : 8;
+    if (n < 1) {
+        std::cerr << "usage: " << argv[0] << " [number of configurations]" << std::endl;
+        return 1;
+    }
         
     std::ofstream file("init_data");
     parallel_mt_seq<> initializer(0);
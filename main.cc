@@ -1,19 +1,97 @@
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <string>
 
 #include "autoreg_driver.hh"
+#include "server.hh"
 
-int main() {
+void usage(const char* argv0) {
+	std::cerr << "usage: " << argv0 << '\n'
+		<< "       " << argv0 << " --server PATH [-j WORKERS] [-m METRICS_FILE] [-o OUTPUT_DIR]\n"
+		<< "       " << argv0 << " --client PATH < request\n"
+		<< "       " << argv0 << " --tune\n"
+		<< "       " << argv0 << " --plan\n";
+}
+
+int main(int argc, char* argv[]) {
 
 	using namespace autoreg;
 
 	/// floating point type (float, double, long double or multiprecision number C++ class)
 	typedef float Real;
 
+	std::string server_path;
+	std::string client_path;
+	std::string metrics_file;
+	std::string output_dir;
+	int nworkers = 2;
+	bool tune = false;
+	bool plan = false;
+	for (int i=1; i<argc; ++i) {
+		const bool has_arg = i+1 < argc;
+		if (std::strcmp(argv[i], "--server") == 0 && has_arg) server_path = argv[++i];
+		else if (std::strcmp(argv[i], "--client") == 0 && has_arg) client_path = argv[++i];
+		else if (std::strcmp(argv[i], "-j") == 0 && has_arg) nworkers = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "-m") == 0 && has_arg) metrics_file = argv[++i];
+		else if (std::strcmp(argv[i], "-o") == 0 && has_arg) output_dir = argv[++i];
+		else if (std::strcmp(argv[i], "--tune") == 0) tune = true;
+		else if (std::strcmp(argv[i], "--plan") == 0) plan = true;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	try {
+		if (!client_path.empty()) {
+			send_request(client_path, std::cin, std::cout);
+			return 0;
+		}
+		if (!server_path.empty()) {
+			Autoreg_server<Real> server(server_path, nworkers);
+			server.metrics_file(metrics_file);
+			server.output_dir(output_dir);
+			server.run();
+			return 0;
+		}
+	} catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return 1;
+	}
+
 	/// input file with various model parameters
 	const char* input_filename = "autoreg.model";
 	Autoreg_model<Real> model;
+	const std::string profile_name = profile_filename();
+	if (tune) {
+		std::ifstream cfg(input_filename);
+		cfg >> model;
+		std::ofstream profile(profile_name);
+		model.tune(profile);
+		std::clog << "profile is written to " << profile_name << std::endl;
+		return 0;
+	}
+	// parameters from autoreg.model override tuned ones
+	std::ifstream profile(profile_name);
+	if (profile.is_open()) {
+		std::clog << "using " << profile_name << std::endl;
+		profile >> model;
+	}
 	std::ifstream cfg(input_filename);
 	cfg >> model;
+	if (plan) {
+		const Plan estimate = model.plan();
+		std::cout << estimate;
+		try {
+			model.check_budget(estimate);
+		} catch (const std::exception& err) {
+			std::cerr << err.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
 	model.act();
 	return 0;
 }
@@ -0,0 +1,362 @@
+#ifndef MEMORY_HH
+#define MEMORY_HH
+
+#include <algorithm>             // for max
+#include <cstddef>               // for size_t
+#include <cstdint>               // for uintptr_t
+#include <cstdlib>               // for posix_memalign, free
+#include <limits>                // for numeric_limits
+#include <map>                   // for map, multimap
+#include <mutex>                 // for mutex, lock_guard
+#include <new>                   // for bad_alloc
+#include <ostream>               // for ostream
+
+#include <sys/mman.h>            // for mmap, munmap, madvise
+#include <sys/resource.h>        // for getrusage
+#include <unistd.h>              // for sysconf
+
+#include <blitz/array.h>         // for Array, neverDeleteData
+
+/// @file
+/// Arena allocator for large arrays.
+///
+/// Buffers of at least 2 MB are mapped with mmap, aligned to 2 MB and marked
+/// with MADV_HUGEPAGE, so that the kernel backs them with transparent huge
+/// pages. Smaller buffers are aligned to cache line (64 bytes). Released
+/// buffers are kept in the arena and are reused by subsequent requests of
+/// similar size (e.g. by the next realisation in the server), until the
+/// arena is reset or their total size exceeds the limit (a quarter of
+/// physical memory by default).
+
+namespace autoreg {
+
+	/// Page faults of the process so far.
+	struct Page_faults {
+		long minor = 0;
+		long major = 0;
+	};
+
+	inline Page_faults
+	page_faults() {
+		Page_faults result;
+		rusage usage;
+		if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+			result.minor = usage.ru_minflt;
+			result.major = usage.ru_majflt;
+		}
+		return result;
+	}
+
+	struct Arena_stats {
+		/// Number of buffers obtained from the system.
+		size_t allocations = 0;
+		/// Number of requests satisfied with released buffers.
+		size_t reuses = 0;
+		/// Bytes currently obtained from the system.
+		size_t bytes = 0;
+		/// Maximum of @bytes.
+		size_t peak_bytes = 0;
+		/// Bytes marked for transparent huge pages.
+		size_t huge_bytes = 0;
+	};
+
+	inline std::ostream&
+	operator<<(std::ostream& out, const Arena_stats& rhs) {
+		return out << "allocations=" << rhs.allocations
+			<< " reuses=" << rhs.reuses
+			<< " bytes=" << rhs.bytes
+			<< " peak_bytes=" << rhs.peak_bytes
+			<< " huge_bytes=" << rhs.huge_bytes;
+	}
+
+	class Arena {
+
+	public:
+		/// Buffers of this size and larger are backed by huge pages.
+		static const size_t huge_page_size = size_t(2) << 20;
+		static const size_t alignment = 64;
+
+		Arena(): _max_free_bytes(physical_memory()/4) {}
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		~Arena() {
+			reset();
+			// buffers that are still in use are leaked intentionally
+		}
+
+		/// Buffer of at least @n bytes aligned to 64 bytes.
+		void*
+		acquire(size_t n) {
+			n = std::max(round_up(n, alignment), alignment);
+			std::lock_guard<std::mutex> lock(_mutex);
+			// the smallest free buffer that wastes less than a half
+			auto it = _free.lower_bound(n);
+			if (it != _free.end() && it->first <= 2*n) {
+				void* ptr = it->second.ptr;
+				_free_bytes -= it->first;
+				_released.erase(it->second.serial);
+				_free.erase(it);
+				++_stats.reuses;
+				return ptr;
+			}
+			const size_t size = n >= huge_page_size ? round_up(n, huge_page_size) : n;
+			Buffer buffer{size, false};
+			void* ptr = size >= huge_page_size ? map_huge(size, buffer.advised) : allocate_small(size);
+			_sizes[ptr] = buffer;
+			++_stats.allocations;
+			_stats.bytes += size;
+			_stats.peak_bytes = std::max(_stats.peak_bytes, _stats.bytes);
+			return ptr;
+		}
+
+		/// Return buffer to the arena for reuse. If released buffers take
+		/// more than max_free_bytes(), the least recently released ones
+		/// are returned to the system.
+		void
+		release(void* ptr) {
+			if (!ptr) return;
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _sizes.find(ptr);
+			if (it != _sizes.end()) {
+				const unsigned long serial = ++_nreleases;
+				_released[serial] = _free.emplace(it->second.size, Free_buffer{ptr, serial});
+				_free_bytes += it->second.size;
+			}
+			while (_free_bytes > _max_free_bytes) {
+				const auto oldest = _released.begin()->second;
+				free_buffer(oldest->second.ptr);
+				_free_bytes -= oldest->first;
+				_free.erase(oldest);
+				_released.erase(_released.begin());
+			}
+		}
+
+		/// Return memory of all released buffers to the system.
+		void
+		reset() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (const auto& pair : _free) {
+				free_buffer(pair.second.ptr);
+			}
+			_free.clear();
+			_released.clear();
+			_free_bytes = 0;
+		}
+
+		/// The maximal total size of released buffers kept for reuse
+		/// (a quarter of physical memory by default). Otherwise a long-running
+		/// process that gets requests of different sizes (the server) keeps
+		/// buffers that are too large or too small for new requests forever.
+		void
+		max_free_bytes(size_t n) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_max_free_bytes = n;
+		}
+
+		Arena_stats
+		stats() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _stats;
+		}
+
+	private:
+		struct Buffer {
+			size_t size;
+			/// Marked with MADV_HUGEPAGE.
+			bool advised;
+		};
+
+		struct Free_buffer {
+			void* ptr;
+			/// Order of release.
+			unsigned long serial;
+		};
+
+		/// Unmap or free buffer @ptr obtained from the system.
+		void
+		free_buffer(void* ptr) {
+			auto it = _sizes.find(ptr);
+			const Buffer buffer = it->second;
+			if (buffer.size >= huge_page_size) {
+				::munmap(ptr, buffer.size);
+			} else {
+				std::free(ptr);
+			}
+			if (buffer.advised) {
+				_stats.huge_bytes -= buffer.size;
+			}
+			_stats.bytes -= buffer.size;
+			_sizes.erase(it);
+		}
+
+		/// Size of physical memory or the maximal size_t if it is unknown.
+		static size_t
+		physical_memory() {
+			const long pages = ::sysconf(_SC_PHYS_PAGES);
+			const long page_size = ::sysconf(_SC_PAGESIZE);
+			if (pages <= 0 || page_size <= 0) {
+				return std::numeric_limits<size_t>::max();
+			}
+			return size_t(pages)*size_t(page_size);
+		}
+
+		static size_t
+		round_up(size_t n, size_t m) {
+			return (n + m - 1) / m * m;
+		}
+
+		void*
+		allocate_small(size_t size) {
+			void* ptr = nullptr;
+			if (::posix_memalign(&ptr, alignment, size) != 0) {
+				throw std::bad_alloc();
+			}
+			return ptr;
+		}
+
+		/// Map @size bytes aligned to huge page boundary: extra huge page
+		/// is mapped and the unaligned head and tail are unmapped.
+		/// @advised is set if the buffer is marked for huge pages.
+		void*
+		map_huge(size_t size, bool& advised) {
+			const size_t len = size + huge_page_size;
+			void* raw = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (raw == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+			const uintptr_t begin = uintptr_t(raw);
+			const uintptr_t aligned = round_up(begin, huge_page_size);
+			const size_t head = aligned - begin;
+			const size_t tail = len - head - size;
+			if (head > 0) ::munmap(raw, head);
+			if (tail > 0) ::munmap((void*)(aligned + size), tail);
+			#if defined(MADV_HUGEPAGE)
+			if (::madvise((void*)aligned, size, MADV_HUGEPAGE) == 0) {
+				_stats.huge_bytes += size;
+				advised = true;
+			}
+			#endif
+			return (void*)aligned;
+		}
+
+		/// All buffers obtained from the system.
+		std::map<void*,Buffer> _sizes;
+		typedef std::multimap<size_t,Free_buffer> Free_map;
+		/// Released buffers by size.
+		Free_map _free;
+		/// Released buffers in order of release, for eviction.
+		std::map<unsigned long,Free_map::iterator> _released;
+		/// Total size of released buffers.
+		size_t _free_bytes = 0;
+		size_t _max_free_bytes;
+		unsigned long _nreleases = 0;
+		Arena_stats _stats;
+		std::mutex _mutex;
+	};
+
+	/// Arena shared by all stages of the programme.
+	inline Arena&
+	default_arena() {
+		static Arena arena;
+		return arena;
+	}
+
+	/// Buffer of @n elements of type @T that is returned to the arena
+	/// on destruction.
+	template<class T>
+	class Arena_buffer {
+
+	public:
+		explicit
+		Arena_buffer(size_t n, Arena& arena = default_arena()):
+		_arena(&arena),
+		_data(static_cast<T*>(arena.acquire(n*sizeof(T)))),
+		_size(n)
+		{}
+
+		Arena_buffer(Arena_buffer&& rhs):
+		_arena(rhs._arena),
+		_data(rhs._data),
+		_size(rhs._size)
+		{ rhs._data = nullptr; }
+
+		Arena_buffer(const Arena_buffer&) = delete;
+		Arena_buffer& operator=(const Arena_buffer&) = delete;
+
+		~Arena_buffer() {
+			_arena->release(_data);
+		}
+
+		T* data() { return _data; }
+		size_t size() const { return _size; }
+		T& operator[](size_t i) { return _data[i]; }
+
+	private:
+		Arena* _arena;
+		T* _data;
+		size_t _size;
+	};
+
+	/// Row-major strides of array of @shape with elements of @element_size
+	/// bytes, in which rows and planes are padded by a cache line if their
+	/// size in bytes is a multiple of a page (e.g. 32x32 floats). Otherwise
+	/// the same elements of consecutive planes map to the same cache sets.
+	template<int N>
+	blitz::TinyVector<std::ptrdiff_t,N>
+	padded_strides(const blitz::TinyVector<int,N>& shape, size_t element_size) {
+		const std::ptrdiff_t page = 4096;
+		const std::ptrdiff_t line = std::max<std::ptrdiff_t>(1, 64 / element_size);
+		blitz::TinyVector<std::ptrdiff_t,N> strides;
+		std::ptrdiff_t stride = 1;
+		for (int i=N-1; i>=0; --i) {
+			strides(i) = stride;
+			stride *= shape(i);
+			if (i > 0 && stride*std::ptrdiff_t(element_size) % page == 0) {
+				stride += line;
+			}
+		}
+		return strides;
+	}
+
+	/// Blitz array that uses arena buffer as preexisting memory.
+	/// The array (and all views of it) are valid while the object exists.
+	template<class T, int N>
+	class Arena_array {
+
+	public:
+		explicit
+		Arena_array(const blitz::TinyVector<int,N>& shape, Arena& arena = default_arena()):
+		_buffer(num_elements(shape), arena),
+		_array(_buffer.data(), shape, blitz::neverDeleteData)
+		{}
+
+		/// Array with row-major @strides, e.g. from padded_strides().
+		Arena_array(const blitz::TinyVector<int,N>& shape,
+			const blitz::TinyVector<std::ptrdiff_t,N>& strides,
+			Arena& arena = default_arena()):
+		_buffer(size_t(shape(0))*strides(0), arena),
+		_array(_buffer.data(), shape, strides, blitz::neverDeleteData)
+		{}
+
+		Arena_array(Arena_array&&) = default;
+
+		blitz::Array<T,N>& array() { return _array; }
+		operator blitz::Array<T,N>&() { return _array; }
+
+	private:
+		static size_t
+		num_elements(const blitz::TinyVector<int,N>& shape) {
+			size_t n = 1;
+			for (int i=0; i<N; ++i) n *= size_t(shape(i));
+			return n;
+		}
+
+		Arena_buffer<T> _buffer;
+		blitz::Array<T,N> _array;
+	};
+
+}
+
+#endif // MEMORY_HH
@@ -0,0 +1,233 @@
+#ifndef ORDER_HH
+#define ORDER_HH
+
+#include <cmath>                 // for pow, sqrt
+#include <limits>                // for numeric_limits
+#include <vector>                // for vector
+
+#include <blitz/array.h>         // for Array, Range
+
+#include "autoreg.hh"            // for compute_AR_coefs, is_stationary, white_noise_variance
+#include "pcg.hh"                // for Multilevel_toeplitz, compute_AR_coefs_pcg
+#include "separable.hh"          // for compute_AR_coefs_separable, levinson_durbin
+#include "types.hh"              // for ACF, AR_coefs, size3
+
+/// @file
+/// Automatic selection of AR model order.
+///
+/// The number of coefficients (fsize) determines the cost of generation,
+/// but ACF usually decays fast, and the coefficients of the model of
+/// acf_size are close to zero far from the origin. The smallest model is
+/// chosen such that white noise variance and the residual of Yule-Walker
+/// equations of the whole ACF differ from those of the full model
+/// by no more than the given tolerance.
+
+namespace autoreg {
+
+	/// The result of order selection.
+	struct Order_stats {
+		size3 fsize{0,0,0};
+		/// Relative increase of white noise variance over the full model.
+		double var_wn_error = 0;
+		/// Relative residual of Yule-Walker equations of the whole ACF.
+		double residual = 0;
+		/// The number of models that were fitted.
+		int candidates = 0;
+		/// True if the search was stopped because of its cost.
+		bool capped = false;
+	};
+
+	/// ACF truncated to @size.
+	template<class T>
+	ACF<T>
+	truncate_acf(const ACF<T>& acf, const size3& size) {
+		using blitz::Range;
+		ACF<T> result(size);
+		result = acf(Range(0, size(0)-1), Range(0, size(1)-1), Range(0, size(2)-1));
+		return result;
+	}
+
+	/// Relative residual of Yule-Walker equations generated by @acf
+	/// for coefficients @phi padded with zeros to the size of @acf,
+	/// i.e. the error of ACF reproduced by the model.
+	template<class T>
+	double
+	yw_residual(const ACF<T>& acf, const AR_coefs<T>& phi) {
+		Multilevel_toeplitz<T> R(acf);
+		const size3 n = acf.shape();
+		const size3 f = phi.shape();
+		const long m = R.num_elements();
+		std::vector<T> x(m, T(0)), b(m), q(m);
+		for (int t=0; t<n(0); ++t) {
+			for (int i=0; i<n(1); ++i) {
+				for (int j=0; j<n(2); ++j) {
+					const long k = Multilevel_toeplitz<T>::index(n, t, i, j);
+					b[k] = acf(t, i, j);
+					if (t < f(0) && i < f(1) && j < f(2)) {
+						x[k] = phi(t, i, j);
+					}
+				}
+			}
+		}
+		x[0] = 0;
+		R.multiply(x, q);
+		// the first equation is eliminated
+		double norm_r = 0, norm_b = 0;
+		for (long i=1; i<m; ++i) {
+			norm_r += double(b[i] - q[i])*double(b[i] - q[i]);
+			norm_b += double(b[i])*double(b[i]);
+		}
+		return norm_b > 0 ? std::sqrt(norm_r / norm_b) : 0.0;
+	}
+
+	/// Choose the smallest filter size for @acf such that white noise
+	/// variance and Yule-Walker residual differ from those of the full
+	/// model by no more than @tolerance. For separable ACF variances of all
+	/// orders along each dimension are given by one Levinson-Durbin
+	/// recursion. Otherwise the filter is grown one layer at a time along
+	/// the dimension that gives the largest decrease of the variance per
+	/// added coefficient; PCG solver starts from the previous coefficients.
+	/// Dense solver solves every candidate from scratch, hence the search
+	/// stops (and the full model is chosen) when the work of candidates
+	/// exceeds the work of the full model, i.e. the search at most
+	/// doubles the time of fitting. Returns the coefficients of the
+	/// chosen model.
+	template<class T>
+	AR_coefs<T>
+	select_AR_order(
+		const ACF<T>& acf,
+		const YW_solver solver,
+		const T tolerance,
+		const T yw_tolerance,
+		Order_stats* stats = nullptr
+	) {
+		const size3 n = acf.shape();
+		Order_stats result;
+		int candidates = 0;
+		// work of dense solutions in units of n^3
+		double dense_work = 0;
+		auto dense_cost = [] (const size3& f) {
+			const double m = double(f(0))*f(1)*f(2);
+			return m*m*m;
+		};
+		auto fit = [&] (const size3& f, const AR_coefs<T>& initial) {
+			const ACF<T> sub = truncate_acf(acf, f);
+			AR_coefs<T> phi;
+			if (f(0)*f(1)*f(2) == 1) {
+				// no coefficients: the model is white noise
+				phi.resize(f);
+				phi = 0;
+			} else {
+				// intermediate models are not checked for stationarity
+				switch (choose_YW_solver(sub, solver)) {
+					case YW_KRONECKER: phi.reference(compute_AR_coefs_separable(sub)); break;
+					case YW_PCG: phi.reference(compute_AR_coefs_pcg(sub, yw_tolerance, initial)); break;
+					default:
+						phi.reference(compute_AR_coefs_dense(sub));
+						dense_work += dense_cost(f);
+						break;
+				}
+			}
+			++candidates;
+			return phi;
+		};
+		auto variance = [&] (const AR_coefs<T>& phi) {
+			return double(white_noise_variance(phi, truncate_acf(acf, phi.shape())));
+		};
+		const AR_coefs<T> full = compute_AR_coefs(acf, solver, yw_tolerance);
+		++candidates;
+		const double var_full = variance(full);
+		auto measure = [&] (const AR_coefs<T>& phi) {
+			result.fsize = phi.shape();
+			result.var_wn_error = (variance(phi) - var_full) / var_full;
+			result.residual = yw_residual(acf, phi);
+		};
+		auto accept = [&] (AR_coefs<T>& phi) {
+			// the residual is computed only for models with small variance
+			if ((variance(phi) - var_full) / var_full > tolerance || !is_stationary(phi)) {
+				return false;
+			}
+			measure(phi);
+			return result.residual <= tolerance;
+		};
+		auto is_full = [&] (const size3& f) {
+			return f(0) == n(0) && f(1) == n(1) && f(2) == n(2);
+		};
+
+		AR_coefs<T> phi;
+		bool found = false;
+		if (choose_YW_solver(acf, solver) == YW_KRONECKER && is_separable(acf)) {
+			// white noise variance of separable model is the product
+			// of one-dimensional variances
+			std::vector<T> var[3];
+			for (int i=0; i<3; ++i) {
+				T v = 0;
+				levinson_durbin(acf_factor(acf, i), v, &var[i]);
+			}
+			double tol = std::pow(1.0 + double(tolerance), 1.0/3.0) - 1.0;
+			while (!found) {
+				size3 f;
+				for (int i=0; i<3; ++i) {
+					f(i) = n(i);
+					while (f(i) > 1 && var[i][f(i)-2] <= var[i][n(i)-1]*(1.0 + tol)) {
+						--f(i);
+					}
+				}
+				if (is_full(f)) {
+					break;
+				}
+				phi.reference(fit(f, AR_coefs<T>()));
+				found = accept(phi);
+				tol *= 0.5;
+			}
+		} else {
+			const double max_dense_work = choose_YW_solver(acf, solver) == YW_DENSE
+				? dense_cost(n) : std::numeric_limits<double>::max();
+			size3 f(1,1,1);
+			phi.reference(fit(f, AR_coefs<T>()));
+			double var_f = variance(phi);
+			while (!(found = accept(phi)) && !is_full(f)) {
+				if (dense_work >= max_dense_work) {
+					result.capped = true;
+					break;
+				}
+				double best_gain = -1;
+				size3 best_f = f;
+				AR_coefs<T> best_phi;
+				double best_var = var_f;
+				for (int i=0; i<3; ++i) {
+					if (f(i) == n(i)) {
+						continue;
+					}
+					size3 g = f;
+					++g(i);
+					const AR_coefs<T> candidate = fit(g, phi);
+					const double var_g = variance(candidate);
+					const double added = double(g(0))*g(1)*g(2) - double(f(0))*f(1)*f(2);
+					const double gain = (var_f - var_g) / added;
+					if (gain > best_gain) {
+						best_gain = gain;
+						best_f = g;
+						best_phi.reference(candidate);
+						best_var = var_g;
+					}
+				}
+				f = best_f;
+				phi.reference(best_phi);
+				var_f = best_var;
+			}
+		}
+		if (!found) {
+			phi.reference(full);
+			measure(phi);
+		}
+		result.candidates = candidates;
+		if (stats) {
+			*stats = result;
+		}
+		return phi;
+	}
+
+}
+
+#endif // ORDER_HH
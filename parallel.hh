@@ -0,0 +1,88 @@
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>             // for min, max
+#include <atomic>                // for atomic
+#include <exception>             // for exception_ptr, rethrow_exception
+#include <thread>                // for hardware_concurrency
+
+#include "thread_pool.hh"        // for Thread_pool, Task_group
+
+/// @file
+/// Parallel loops over index ranges.
+
+namespace autoreg {
+
+	/// Number of threads used by parallel loops.
+	inline std::atomic<int>&
+	parallel_threads() {
+		static std::atomic<int> n(std::max(1u, std::thread::hardware_concurrency()));
+		return n;
+	}
+
+	/// Pool shared by all parallel loops, it is created on first use with
+	/// @parallel_threads() threads including the thread that starts a loop
+	/// (but not less than the number of cores).
+	inline Thread_pool&
+	thread_pool() {
+		static Thread_pool pool(
+			std::max(int(std::max(1u, std::thread::hardware_concurrency())),
+			int(parallel_threads())) - 1
+		);
+		return pool;
+	}
+
+	/// Split [first,last) into contiguous subranges and call @func(begin, end)
+	/// for each of them in at most @parallel_threads() threads of the pool
+	/// (and at most @max_threads, if it is positive). There are several
+	/// subranges per thread, which are taken dynamically, so that threads
+	/// that finish early take the work of the others. The first exception
+	/// thrown by any subrange is rethrown, remaining subranges are skipped.
+	template<class F>
+	void
+	parallel_for(int first, int last, F func, int max_threads = 0) {
+		const int n = last - first;
+		if (n <= 0) {
+			return;
+		}
+		Thread_pool& pool = thread_pool();
+		int nthreads = std::min(n, int(parallel_threads()));
+		if (max_threads > 0) {
+			nthreads = std::min(nthreads, max_threads);
+		}
+		nthreads = std::min(nthreads, pool.num_workers() + 1);
+		if (nthreads <= 1) {
+			func(first, last);
+			return;
+		}
+		const int nchunks = std::min(n, 4*nthreads);
+		std::atomic<int> next(0);
+		auto body = [&] () {
+			try {
+				for (int c; (c = next++) < nchunks; ) {
+					func(first + int(long(n)*c/nchunks), first + int(long(n)*(c+1)/nchunks));
+				}
+			} catch (...) {
+				next = nchunks;
+				throw;
+			}
+		};
+		Task_group group(pool);
+		for (int i=1; i<nthreads; ++i) {
+			group.run(body);
+		}
+		std::exception_ptr error;
+		try {
+			body();
+		} catch (...) {
+			error = std::current_exception();
+		}
+		group.wait();
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+}
+
+#endif // PARALLEL_HH
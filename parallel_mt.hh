@@ -6,6 +6,8 @@
 #include <iterator>
 #include <algorithm>
 #include <cstring>
+#include <istream>
+#include <ostream>
 
 extern "C" {
 #include "dc.h"
@@ -137,6 +139,12 @@ namespace autoreg {
 			init(rhs);
 		}
 
+		/// Generator parameters and the current state (including index @i).
+		const mt_config&
+		config() const noexcept {
+			return _config;
+		}
+
 	private:
 
 		void
@@ -146,6 +154,18 @@ namespace autoreg {
 
 		mt_config _config;
 
+		/// The state is written in binary format and is restored as is
+		/// (without seeding).
+		friend std::ostream&
+		operator<<(std::ostream& out, const parallel_mt& rhs) {
+			return out << rhs._config;
+		}
+
+		friend std::istream&
+		operator>>(std::istream& in, parallel_mt& rhs) {
+			return in >> rhs._config;
+		}
+
 	};
 
 }
@@ -0,0 +1,315 @@
+#ifndef PCG_HH
+#define PCG_HH
+
+#include <algorithm>             // for max, copy_n
+#include <cmath>                 // for sqrt
+#include <complex>               // for complex, real
+#include <limits>                // for numeric_limits
+#include <sstream>               // for stringstream
+#include <stdexcept>             // for runtime_error
+#include <vector>                // for vector
+
+#include <blitz/array.h>         // for Array
+
+#include "fft.hh"                // for DFT_3d, next_power_of_two
+#include "types.hh"              // for ACF, AR_coefs, size3
+
+/// @file
+/// Matrix-free solver of Yule-Walker equations.
+///
+/// Autocovariance matrix R of the AR process is three-level symmetric
+/// Toeplitz matrix: R((t,x,y),(t',x',y')) = acf(|t-t'|,|x-x'|,|y-y'|).
+/// Its product with a vector is computed by embedding R into a three-level
+/// circulant matrix of power-of-two size and using FFT, so neither R nor
+/// its factorisation is stored. The system is solved by preconditioned
+/// conjugate gradient method, preconditioner is T. Chan optimal
+/// multilevel circulant approximation of R. As in compute_AR_coefs,
+/// the first equation is eliminated, i.e. the first unknown is fixed
+/// to zero.
+
+namespace autoreg {
+
+	/// Product of three-level symmetric Toeplitz matrix generated by @acf
+	/// and a vector.
+	template<class T>
+	class Multilevel_toeplitz {
+
+	public:
+		typedef std::complex<T> complex_type;
+
+		explicit
+		Multilevel_toeplitz(const ACF<T>& acf):
+		_size(acf.shape()),
+		_dft(size3(
+			next_power_of_two(2*acf.extent(0)-1),
+			next_power_of_two(2*acf.extent(1)-1),
+			next_power_of_two(2*acf.extent(2)-1)
+		)),
+		_eigenvalues(_dft.num_elements()),
+		_work(_dft.num_elements())
+		{
+			// the first column of the embedding circulant matrix
+			const size3 ext = _dft.shape();
+			std::fill(_work.begin(), _work.end(), complex_type(0));
+			for (int t=0; t<ext(0); ++t) {
+				const int at = std::min(t, ext(0)-t);
+				if (at >= _size(0)) continue;
+				for (int x=0; x<ext(1); ++x) {
+					const int ax = std::min(x, ext(1)-x);
+					if (ax >= _size(1)) continue;
+					for (int y=0; y<ext(2); ++y) {
+						const int ay = std::min(y, ext(2)-y);
+						if (ay >= _size(2)) continue;
+						_work[index(ext, t, x, y)] = acf(at, ax, ay);
+					}
+				}
+			}
+			_dft.transform(_work, -1);
+			const T scale = T(1) / T(_dft.num_elements());
+			for (long i=0; i<_dft.num_elements(); ++i) {
+				_eigenvalues[i] = std::real(_work[i]) * scale;
+			}
+		}
+
+		long
+		num_elements() const {
+			return long(_size(0))*_size(1)*_size(2);
+		}
+
+		/// Compute @y = R @x, both vectors are in row-major order.
+		void
+		multiply(const std::vector<T>& x, std::vector<T>& y) {
+			const size3 ext = _dft.shape();
+			std::fill(_work.begin(), _work.end(), complex_type(0));
+			for (int t=0; t<_size(0); ++t) {
+				for (int i=0; i<_size(1); ++i) {
+					const T* src = &x[index(_size, t, i, 0)];
+					complex_type* dst = &_work[index(ext, t, i, 0)];
+					for (int j=0; j<_size(2); ++j) {
+						dst[j] = src[j];
+					}
+				}
+			}
+			_dft.transform_padded(_work, -1, _size);
+			for (long i=0; i<_dft.num_elements(); ++i) {
+				_work[i] *= _eigenvalues[i];
+			}
+			_dft.transform_truncated(_work, 1, _size);
+			for (int t=0; t<_size(0); ++t) {
+				for (int i=0; i<_size(1); ++i) {
+					const complex_type* src = &_work[index(ext, t, i, 0)];
+					T* dst = &y[index(_size, t, i, 0)];
+					for (int j=0; j<_size(2); ++j) {
+						dst[j] = std::real(src[j]);
+					}
+				}
+			}
+		}
+
+		static long
+		index(const size3& ext, int t, int x, int y) {
+			return (long(t)*ext(1) + x)*ext(2) + y;
+		}
+
+	private:
+		size3 _size;
+		DFT_3d<T> _dft;
+		/// Eigenvalues of the circulant divided by its size
+		/// (normalisation of the inverse transform).
+		std::vector<T> _eigenvalues;
+		std::vector<complex_type> _work;
+	};
+
+	/// T. Chan optimal three-level circulant preconditioner.
+	/// Its first column minimises Frobenius norm of the difference with R,
+	/// along each dimension c(k) = ((n-k) a(k) + k a(n-k)) / n.
+	template<class T>
+	class Circulant_preconditioner {
+
+	public:
+		typedef std::complex<T> complex_type;
+
+		explicit
+		Circulant_preconditioner(const ACF<T>& acf):
+		_dft(acf.shape()),
+		_eigenvalues(_dft.num_elements()),
+		_work(_dft.num_elements())
+		{
+			const size3 n = acf.shape();
+			for (int t=0; t<n(0); ++t) {
+				for (int x=0; x<n(1); ++x) {
+					for (int y=0; y<n(2); ++y) {
+						T sum = 0;
+						// each dimension contributes either lag k or lag n-k
+						for (int s=0; s<8; ++s) {
+							const int k[3] = {t, x, y};
+							int lag[3];
+							T weight = 1;
+							for (int d=0; d<3; ++d) {
+								if (s & (1 << d)) {
+									weight *= T(k[d]) / T(n(d));
+									lag[d] = k[d] == 0 ? 0 : n(d) - k[d];
+								} else {
+									weight *= T(n(d) - k[d]) / T(n(d));
+									lag[d] = k[d];
+								}
+							}
+							if (weight != T(0)) {
+								sum += weight*acf(lag[0], lag[1], lag[2]);
+							}
+						}
+						_work[Multilevel_toeplitz<T>::index(n, t, x, y)] = sum;
+					}
+				}
+			}
+			_dft.transform(_work, -1);
+			T max_eigenvalue = 0;
+			for (long i=0; i<_dft.num_elements(); ++i) {
+				_eigenvalues[i] = std::real(_work[i]);
+				max_eigenvalue = std::max(max_eigenvalue, _eigenvalues[i]);
+			}
+			// circulant approximation of positive definite matrix
+			// may be indefinite, small eigenvalues are clamped
+			const T min_eigenvalue = max_eigenvalue * std::sqrt(std::numeric_limits<T>::epsilon());
+			const T scale = T(1) / T(_dft.num_elements());
+			for (long i=0; i<_dft.num_elements(); ++i) {
+				_eigenvalues[i] = scale / std::max(_eigenvalues[i], min_eigenvalue);
+			}
+		}
+
+		/// Compute @z = C^{-1} @r.
+		void
+		apply(const std::vector<T>& r, std::vector<T>& z) {
+			const long n = _dft.num_elements();
+			for (long i=0; i<n; ++i) {
+				_work[i] = r[i];
+			}
+			_dft.transform(_work, -1);
+			for (long i=0; i<n; ++i) {
+				_work[i] *= _eigenvalues[i];
+			}
+			_dft.transform(_work, 1);
+			for (long i=0; i<n; ++i) {
+				z[i] = std::real(_work[i]);
+			}
+		}
+
+	private:
+		DFT_3d<T> _dft;
+		/// Inverse eigenvalues divided by the circulant size.
+		std::vector<T> _eigenvalues;
+		std::vector<complex_type> _work;
+	};
+
+	/// Convergence history of the last PCG solve.
+	struct PCG_stats {
+		int iterations = 0;
+		double residual = 0;
+	};
+
+	template<class T>
+	T
+	dot(const std::vector<T>& a, const std::vector<T>& b) {
+		T sum = 0;
+		const long n = a.size();
+		for (long i=0; i<n; ++i) {
+			sum += a[i]*b[i];
+		}
+		return sum;
+	}
+
+	/// Solve Yule-Walker equations by PCG method until relative residual
+	/// is less than @tolerance. If @initial is not empty, it is used as
+	/// the initial guess (e.g. coefficients of the model with smaller
+	/// @acf_size), otherwise the iterations start from zero.
+	template<class T>
+	AR_coefs<T>
+	compute_AR_coefs_pcg(
+		const ACF<T>& acf,
+		const T tolerance,
+		const AR_coefs<T>& initial = AR_coefs<T>(),
+		PCG_stats* stats = nullptr
+	) {
+		Multilevel_toeplitz<T> R(acf);
+		Circulant_preconditioner<T> C(acf);
+		const size3 n = acf.shape();
+		const long m = R.num_elements();
+		std::vector<T> x(m, T(0)), r(m), z(m), p(m), q(m);
+
+		// the right-hand side is the first column of R without the first element
+		std::vector<T> b(m);
+		for (int t=0; t<n(0); ++t) {
+			for (int i=0; i<n(1); ++i) {
+				for (int j=0; j<n(2); ++j) {
+					b[Multilevel_toeplitz<T>::index(n, t, i, j)] = acf(t, i, j);
+				}
+			}
+		}
+		b[0] = 0;
+		const T norm_b = std::sqrt(dot(b, b));
+
+		// initial guess is truncated or padded with zeros
+		if (initial.numElements() > 0) {
+			const size3 n0 = initial.shape();
+			for (int t=0; t<std::min(n(0), n0(0)); ++t) {
+				for (int i=0; i<std::min(n(1), n0(1)); ++i) {
+					for (int j=0; j<std::min(n(2), n0(2)); ++j) {
+						x[Multilevel_toeplitz<T>::index(n, t, i, j)] = initial(t, i, j);
+					}
+				}
+			}
+			x[0] = 0;
+		}
+		R.multiply(x, q);
+		for (long i=0; i<m; ++i) {
+			r[i] = b[i] - q[i];
+		}
+		r[0] = 0;
+
+		const int max_iterations = int(std::min(10*m, 100000L));
+		T norm_r = std::sqrt(dot(r, r));
+		int iter = 0;
+		T rho = 0;
+		while (norm_r > tolerance*norm_b && iter < max_iterations) {
+			C.apply(r, z);
+			z[0] = 0;
+			const T rho_new = dot(r, z);
+			if (iter == 0) {
+				p = z;
+			} else {
+				const T beta = rho_new / rho;
+				for (long i=0; i<m; ++i) {
+					p[i] = z[i] + beta*p[i];
+				}
+			}
+			rho = rho_new;
+			R.multiply(p, q);
+			q[0] = 0;
+			const T alpha = rho / dot(p, q);
+			for (long i=0; i<m; ++i) {
+				x[i] += alpha*p[i];
+				r[i] -= alpha*q[i];
+			}
+			norm_r = std::sqrt(dot(r, r));
+			++iter;
+		}
+		if (stats) {
+			stats->iterations = iter;
+			stats->residual = norm_b > T(0) ? double(norm_r / norm_b) : 0.0;
+		}
+		if (!(norm_r <= tolerance*norm_b)) {
+			std::stringstream msg;
+			msg << "PCG did not converge in " << iter
+				<< " iterations, relative residual = " << norm_r / norm_b;
+			throw std::runtime_error(msg.str());
+		}
+
+		AR_coefs<T> phi(n);
+		std::copy_n(x.begin(), m, phi.data());
+		phi(0,0,0) = 0;
+		return phi;
+	}
+
+}
+
+#endif // PCG_HH
@@ -0,0 +1,165 @@
+#ifndef PERF_HH
+#define PERF_HH
+
+#include <cstdint>               // for uint64_t
+#include <cstdlib>               // for atoi
+#include <cstring>               // for memset
+#include <ostream>               // for ostream
+#include <vector>                // for vector
+
+#include <dirent.h>              // for opendir, readdir, closedir
+#include <linux/perf_event.h>    // for perf_event_attr, PERF_*
+#include <sys/ioctl.h>           // for ioctl
+#include <sys/syscall.h>         // for __NR_perf_event_open
+#include <unistd.h>              // for syscall, read, close
+
+/// @file
+/// Hardware cache counters of the calling thread or of all threads of the
+/// process, e.g. the workers of the pool (Linux perf_event_open).
+///
+/// Counters are not available in some virtual machines or if
+/// kernel.perf_event_paranoid forbids them, in this case
+/// available() returns false and the counts are zero.
+
+namespace autoreg {
+
+	struct Cache_counts {
+		/// Last level cache references and misses.
+		uint64_t references = 0;
+		uint64_t misses = 0;
+		/// L1 data cache read misses.
+		uint64_t l1d_misses = 0;
+	};
+
+	inline std::ostream&
+	operator<<(std::ostream& out, const Cache_counts& rhs) {
+		return out << "references=" << rhs.references
+			<< " misses=" << rhs.misses
+			<< " l1d_misses=" << rhs.l1d_misses;
+	}
+
+	class Cache_counters {
+
+	public:
+		/// If @all_threads is true, the counts are summed over all threads
+		/// that exist when the object is created (and threads they start).
+		explicit
+		Cache_counters(bool all_threads = false) {
+			std::vector<int> tids;
+			if (all_threads) {
+				tids = thread_ids();
+			}
+			if (tids.empty()) {
+				tids.push_back(0);
+			}
+			open_counters(_fd[0], tids, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+			open_counters(_fd[1], tids, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+			open_counters(_fd[2], tids, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+		}
+
+		~Cache_counters() {
+			for (const std::vector<int>& fds : _fd) {
+				for (int fd : fds) ::close(fd);
+			}
+		}
+
+		Cache_counters(const Cache_counters&) = delete;
+		Cache_counters& operator=(const Cache_counters&) = delete;
+
+		bool
+		available() const {
+			return !_fd[0].empty() && !_fd[1].empty();
+		}
+
+		void
+		start() {
+			for (const std::vector<int>& fds : _fd) {
+				for (int fd : fds) {
+					::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+					::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+		}
+
+		Cache_counts
+		stop() {
+			uint64_t values[3] = {0, 0, 0};
+			for (int i=0; i<3; ++i) {
+				for (int fd : _fd[i]) {
+					::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+					uint64_t value = 0;
+					if (::read(fd, &value, sizeof(uint64_t)) == sizeof(uint64_t)) {
+						values[i] += value;
+					}
+				}
+			}
+			Cache_counts result;
+			result.references = values[0];
+			result.misses = values[1];
+			result.l1d_misses = values[2];
+			return result;
+		}
+
+	private:
+		/// Identifiers of all threads of the process.
+		static std::vector<int>
+		thread_ids() {
+			std::vector<int> result;
+			DIR* dir = ::opendir("/proc/self/task");
+			if (!dir) {
+				return result;
+			}
+			while (const dirent* entry = ::readdir(dir)) {
+				const int tid = std::atoi(entry->d_name);
+				if (tid > 0) result.push_back(tid);
+			}
+			::closedir(dir);
+			return result;
+		}
+
+		/// Counter for each thread of @tids (0 is the calling thread);
+		/// if any of them is not available, none are opened.
+		static void
+		open_counters(std::vector<int>& fds, const std::vector<int>& tids,
+			uint32_t type, uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			for (int tid : tids) {
+				const int fd = int(::syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0));
+				if (fd < 0) {
+					for (int f : fds) ::close(f);
+					fds.clear();
+					return;
+				}
+				fds.push_back(fd);
+			}
+		}
+
+		/// Descriptors of references, misses and L1 misses for each thread.
+		std::vector<int> _fd[3];
+	};
+
+	/// Cache counts of @func() in the calling thread, or in all threads
+	/// if @all_threads is true (zeros if the counters are not available).
+	template<class F>
+	Cache_counts
+	count_cache_misses(F func, bool all_threads = false) {
+		Cache_counters counters(all_threads);
+		counters.start();
+		func();
+		return counters.stop();
+	}
+
+}
+
+#endif // PERF_HH
@@ -0,0 +1,120 @@
+#ifndef PLAN_HH
+#define PLAN_HH
+
+#include <algorithm>             // for max
+#include <iomanip>               // for setw
+#include <ostream>               // for ostream
+#include <string>                // for string
+#include <vector>                // for vector
+
+/// @file
+/// Estimates of memory and run time of the programme stages.
+///
+/// Memory is estimated from array sizes, run time from the number of
+/// operations and the throughput of the kernels measured by --tune
+/// (or conservative single-core defaults).
+
+namespace autoreg {
+
+	/// Throughput of the kernels with tuned parameters.
+	struct Throughput {
+		/// White noise values per second.
+		double noise = 2e7;
+		/// Floating point operations per second of LAPACK solver.
+		double sysv = 5e9;
+		/// Floating point operations per second of FFT in PCG solver.
+		double fft = 1e9;
+		/// Floating point operations per second of the full generator
+		/// (in one thread).
+		double full = 1.5e9;
+		/// Points per second of the separable generator.
+		double separable = 2e7;
+		/// Bytes of text per second written by the text sink.
+		double write = 1e7;
+	};
+
+	struct Plan_stage {
+		std::string name;
+		/// Memory allocated by the stage (in addition to the surface).
+		double memory = 0;
+		double flops = 0;
+		double seconds = 0;
+		/// The stage is executed at the same time as the previous one.
+		bool concurrent = false;
+	};
+
+	struct Plan {
+
+		void
+		add(const std::string& name, double memory, double flops, double seconds,
+			bool concurrent = false)
+		{
+			Plan_stage stage;
+			stage.name = name;
+			stage.memory = memory;
+			stage.flops = flops;
+			stage.seconds = seconds;
+			stage.concurrent = concurrent;
+			stages.push_back(stage);
+		}
+
+		/// Peak memory in bytes: the surface and the largest stage
+		/// (concurrent stages are summed).
+		double
+		peak_memory() const {
+			double peak = 0;
+			double current = 0;
+			for (const Plan_stage& s : stages) {
+				current = s.concurrent ? current + s.memory : s.memory;
+				peak = std::max(peak, current);
+			}
+			return resident + peak;
+		}
+
+		/// Run time in seconds (concurrent stages overlap).
+		double
+		seconds() const {
+			double total = 0;
+			double last = 0;
+			for (const Plan_stage& s : stages) {
+				if (s.concurrent) {
+					total += std::max(0.0, s.seconds - last);
+					last = std::max(last, s.seconds);
+				} else {
+					total += s.seconds;
+					last = s.seconds;
+				}
+			}
+			return total;
+		}
+
+		std::vector<Plan_stage> stages;
+		/// Memory allocated during the whole run (the enlarged surface).
+		double resident = 0;
+	};
+
+	inline std::ostream&
+	operator<<(std::ostream& out, const Plan& rhs) {
+		const double mb = 1024.0*1024.0;
+		out << std::left << std::setw(36) << "stage"
+			<< std::setw(14) << "memory, MB"
+			<< std::setw(14) << "GFLOP"
+			<< "time, s" << '\n';
+		out << std::setw(36) << "surface"
+			<< std::setw(14) << rhs.resident/mb
+			<< std::setw(14) << '-' << '-' << '\n';
+		for (const Plan_stage& s : rhs.stages) {
+			out << std::setw(36) << (s.concurrent ? "  || " + s.name : s.name)
+				<< std::setw(14) << s.memory/mb;
+			if (s.flops > 0) out << std::setw(14) << s.flops*1e-9;
+			else out << std::setw(14) << '-';
+			out << s.seconds << '\n';
+		}
+		out << "peak memory: " << rhs.peak_memory()/mb << " MB\n"
+			<< "time: " << rhs.seconds() << " s" << std::endl;
+		return out;
+	}
+
+}
+
+#endif // PLAN_HH
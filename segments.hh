@@ -0,0 +1,373 @@
+#ifndef SEGMENTS_HH
+#define SEGMENTS_HH
+
+#include <algorithm>             // for min, max, copy_n
+#include <cmath>                 // for abs
+#include <ostream>               // for ostream
+#include <random>                // for mt19937, normal_distribution
+#include <stdexcept>             // for runtime_error
+#include <vector>                // for vector
+
+#include "autoreg.hh"            // for AR_sum, generate_zeta
+#include "memory.hh"             // for Arena_array, Arena_buffer
+#include "parallel.hh"           // for parallel_for
+#include "separable.hh"          // for Separable_AR, separable_filter_t, separable_filter_xy
+#include "stats.hh"              // for Stats, merge_stats
+#include "types.hh"              // for AR_coefs, Zeta, size3
+
+/// @file
+/// Generation of wavy surface by independent time segments.
+///
+/// AR process forgets its initial state after a warm-up span (the same
+/// reason why the enlarged surface is trimmed). Output part of the
+/// enlarged surface is split into segments along time axis. Each segment
+/// is generated in parallel in a separate buffer from its own white noise
+/// preceded by @warmup layers of white noise of the previous segment, and
+/// is written back without the warm-up part. Then first layers of each
+/// segment (except the first one) are re-generated one by one from the
+/// last layers of the previous segment, until the new values of f0
+/// consecutive layers (the state of AR process of order f0 along time)
+/// differ from the independently generated ones by less than @tolerance, so that the
+/// AR recurrence holds across the seams. White noise is the same as for
+/// the whole surface, hence the result differs from the result of
+/// sequential generation only by the warm-up error.
+///
+/// Seams are re-generated with the same arithmetic as the segments:
+/// by the full AR filter (Full_segments) or by the filter along t of
+/// the separable generator (Separable_segments), in the latter case the
+/// filters along x and y are applied to the whole surface after the seams.
+
+namespace autoreg {
+
+	struct Seam_stats {
+		int segments = 0;
+		/// Number of warm-up layers of each segment.
+		int warmup = 0;
+		/// The maximal number of re-generated layers of a seam.
+		int layers = 0;
+		/// The maximal difference between the last f0 re-generated layers
+		/// and the layers generated independently.
+		double discontinuity = 0;
+	};
+
+	inline std::ostream&
+	operator<<(std::ostream& out, const Seam_stats& rhs) {
+		return out << "segments=" << rhs.segments
+			<< " warmup=" << rhs.warmup
+			<< " seam_layers=" << rhs.layers
+			<< " discontinuity=" << rhs.discontinuity;
+	}
+
+	/// Number of time layers after which AR process with coefficients @phi
+	/// forgets its initial state: the recurrence without white noise,
+	/// started from layers of random values with standard deviation
+	/// @sigma on the grid of @nx x @ny points, falls below @tolerance.
+	/// Returns @max_layers, if the process does not forget the state
+	/// in @max_layers layers.
+	template<class T>
+	int
+	AR_memory(const AR_coefs<T>& phi, T sigma, T tolerance, int max_layers, int nx, int ny) {
+		const int f0 = phi.extent(0);
+		const int block = 64;
+		Zeta<T> z(size3(f0 + block, nx, ny));
+		std::mt19937 prng;
+		std::normal_distribution<T> normal(T(0), sigma);
+		for (int t=0; t<f0; ++t) {
+			for (int x=0; x<nx; ++x) {
+				for (int y=0; y<ny; ++y) {
+					z(t, x, y) = normal(prng);
+				}
+			}
+		}
+		int nlayers = 0;
+		int below = 0;
+		while (nlayers < max_layers) {
+			for (int t=f0; t<f0+block && nlayers<max_layers; ++t) {
+				T max_value = 0;
+				for (int x=0; x<nx; ++x) {
+					for (int y=0; y<ny; ++y) {
+						const T value = AR_sum(phi, z, t, x, y);
+						z(t, x, y) = value;
+						max_value = std::max(max_value, std::abs(value));
+					}
+				}
+				++nlayers;
+				// the state consists of f0 layers
+				below = max_value <= tolerance ? below+1 : 0;
+				if (below == f0) {
+					return nlayers;
+				}
+			}
+			// the last f0 layers become the history of the next block
+			for (int t=0; t<f0; ++t) {
+				for (int x=0; x<nx; ++x) {
+					for (int y=0; y<ny; ++y) {
+						z(t, x, y) = z(block + t, x, y);
+					}
+				}
+			}
+		}
+		return max_layers;
+	}
+
+	/// Segments and seams of the full AR filter (generate_zeta).
+	template<class T>
+	class Full_segments {
+
+	public:
+		Full_segments(const AR_coefs<T>& phi, const T scale, const int tile):
+		_phi(phi),
+		_scale(scale),
+		_tile(tile)
+		{}
+
+		/// Statistics are accumulated by generate() and after the seams.
+		static const bool final_pass = false;
+
+		int order() const { return _phi.extent(0); }
+
+		/// Generate @buffer from white noise in it.
+		void
+		generate(Zeta<T>& buffer, Stats<T>* stats, const size3& stats_offset) const {
+			generate_zeta(_phi, buffer, _scale, stats, stats_offset, 0, _tile);
+		}
+
+		/// Re-generate layer @t of @zeta, that contains white noise,
+		/// in the same order of evaluation as generate_zeta.
+		void
+		generate_layer(Zeta<T>& zeta, const int t) const {
+			const int x1 = zeta.extent(1);
+			const int y1 = zeta.extent(2);
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					T& z = zeta(t, x, y);
+					z = _scale*z + AR_sum(_phi, zeta, t, x, y);
+				}
+			}
+		}
+
+		/// The largest change of the surface, if layer @t of @zeta
+		/// changes from @old.
+		double
+		change(const Zeta<T>& zeta, const int t, const std::vector<T>& old) const {
+			const int x1 = zeta.extent(1);
+			const int y1 = zeta.extent(2);
+			double diff = 0;
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					diff = std::max(diff, double(std::abs(zeta(t, x, y) - old[long(x)*y1 + y])));
+				}
+			}
+			return diff;
+		}
+
+		void
+		finish(Zeta<T>&, int, Stats<T>*, const size3&) const {}
+
+	private:
+		const AR_coefs<T>& _phi;
+		T _scale;
+		int _tile;
+	};
+
+	/// Segments and seams of the separable generator
+	/// (generate_zeta_separable): segments and seams are filtered along t,
+	/// then the whole surface is filtered along x and y.
+	template<class T>
+	class Separable_segments {
+
+	public:
+		Separable_segments(const Separable_AR<T>& ar, const T scale, const int block):
+		_ar(ar),
+		_scale(scale),
+		_block(block)
+		{}
+
+		/// Statistics are accumulated by finish().
+		static const bool final_pass = true;
+
+		int order() const { return _ar.filter[0].extent(0); }
+
+		void
+		generate(Zeta<T>& buffer, Stats<T>*, const size3&) const {
+			separable_filter_t(_ar, buffer, _scale);
+		}
+
+		void
+		generate_layer(Zeta<T>& zeta, const int t) const {
+			using blitz::Range;
+			// the layer and its history
+			const int t0 = std::max(0, t - order() + 1);
+			Zeta<T> view = zeta(Range(t0, t), Range::all(), Range::all());
+			separable_filter_t(_ar, view, _scale, t - t0);
+		}
+
+		/// The change of the layer is filtered along x and y,
+		/// i.e. it is the change of the final surface.
+		double
+		change(const Zeta<T>& zeta, const int t, const std::vector<T>& old) const {
+			const int x1 = zeta.extent(1);
+			const int y1 = zeta.extent(2);
+			Zeta<T> diff(size3(1, x1, y1));
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					diff(0, x, y) = zeta(t, x, y) - old[long(x)*y1 + y];
+				}
+			}
+			separable_filter_xy(_ar, diff, _block);
+			double result = 0;
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					result = std::max(result, double(std::abs(diff(0, x, y))));
+				}
+			}
+			return result;
+		}
+
+		void
+		finish(Zeta<T>& zeta, const int t_begin, Stats<T>* stats, const size3& stats_offset) const {
+			separable_filter_xy(_ar, zeta, _block, stats, stats_offset, t_begin);
+		}
+
+	private:
+		const Separable_AR<T>& _ar;
+		T _scale;
+		int _block;
+	};
+
+	/// Generate time layers [@t_begin, end) of @zeta in @nsegments segments.
+	/// White noise (with unit variance) is taken from @zeta. Segments and
+	/// seam layers are generated by @segments (Full_segments or
+	/// Separable_segments). Statistics of the points with indices not less
+	/// than @stats_offset are accumulated in @stats.
+	template<class T, class Segments>
+	Seam_stats
+	generate_zeta_segmented(
+		Zeta<T>& zeta,
+		const int t_begin,
+		const int nsegments,
+		const int warmup,
+		const T tolerance,
+		const Segments& segments,
+		Stats<T>* stats = nullptr,
+		const size3& stats_offset = size3(0,0,0)
+	) {
+		if (!zeta.isStorageContiguous()) {
+			throw std::runtime_error("zeta is not contiguous");
+		}
+		const int t1 = zeta.extent(0);
+		const int x1 = zeta.extent(1);
+		const int y1 = zeta.extent(2);
+		const long layer = long(x1)*y1;
+		const int f0 = segments.order();
+		const int n = nsegments;
+		// statistics of segments and seams, unless they are accumulated
+		// by the final pass
+		Stats<T>* part_stats = Segments::final_pass ? nullptr : stats;
+		std::vector<int> first(n+1), prefix(n), seam(n);
+		for (int s=0; s<=n; ++s) {
+			first[s] = t_begin + int(long(t1 - t_begin)*s/n);
+		}
+		for (int s=0; s<n; ++s) {
+			const int length = first[s+1] - first[s];
+			if (length < 2*f0) {
+				throw std::runtime_error("time segment is shorter than two AR orders");
+			}
+			prefix[s] = std::min(warmup, first[s]);
+			// layers that are not used as the history of the next seam;
+			// at least f0 layers, the state of AR process
+			seam[s] = s == 0 ? 0 : std::max(f0, std::min(warmup, length/2));
+		}
+
+		// white noise of the warm-up parts and of the seams is saved before
+		// it is overwritten by the previous segment
+		std::vector<long> prefix_offset(n+1, 0), seam_offset(n+1, 0);
+		for (int s=0; s<n; ++s) {
+			prefix_offset[s+1] = prefix_offset[s] + prefix[s]*layer;
+			seam_offset[s+1] = seam_offset[s] + seam[s]*layer;
+		}
+		Arena_buffer<T> prefix_noise(std::max(prefix_offset[n], 1L));
+		Arena_buffer<T> seam_noise(std::max(seam_offset[n], 1L));
+		T* data = zeta.data();
+		parallel_for(0, n, [&] (int s_begin, int s_end) {
+			for (int s=s_begin; s<s_end; ++s) {
+				std::copy_n(data + (first[s] - prefix[s])*layer, prefix[s]*layer,
+					prefix_noise.data() + prefix_offset[s]);
+				std::copy_n(data + first[s]*layer, seam[s]*layer,
+					seam_noise.data() + seam_offset[s]);
+			}
+		});
+
+		// segments
+		std::vector<Stats<T>> parts(2*n, part_stats ? part_stats->empty() : Stats<T>());
+		parallel_for(0, n, [&] (int s_begin, int s_end) {
+			for (int s=s_begin; s<s_end; ++s) {
+				const int length = first[s+1] - first[s];
+				Arena_array<T,3> buffer(size3(prefix[s] + length, x1, y1));
+				T* buf = buffer.array().data();
+				std::copy_n(prefix_noise.data() + prefix_offset[s], prefix[s]*layer, buf);
+				std::copy_n(data + first[s]*layer, length*layer, buf + prefix[s]*layer);
+				// seam layers are accounted after re-generation
+				const int t_stats = std::max(first[s] + seam[s], stats_offset[0]) - first[s];
+				segments.generate(buffer.array(), part_stats ? &parts[2*s+1] : nullptr,
+					size3(prefix[s] + t_stats, stats_offset[1], stats_offset[2]));
+				std::copy_n(buf + prefix[s]*layer, length*layer, data + first[s]*layer);
+			}
+		});
+
+		// seams
+		std::vector<int> seam_layers(n, 0);
+		std::vector<double> discontinuity(n, 0);
+		parallel_for(1, n, [&] (int s_begin, int s_end) {
+			std::vector<T> old(layer);
+			std::vector<double> diffs;
+			for (int s=s_begin; s<s_end; ++s) {
+				const T* eps = seam_noise.data() + seam_offset[s];
+				diffs.clear();
+				int below = 0;
+				for (int k=0; k<seam[s]; ++k) {
+					const int t = first[s] + k;
+					T* cur = data + t*layer;
+					std::copy_n(cur, layer, old.begin());
+					std::copy_n(eps + k*layer, layer, cur);
+					segments.generate_layer(zeta, t);
+					const double diff = segments.change(zeta, t, old);
+					seam_layers[s] = k+1;
+					diffs.push_back(diff);
+					// the next layers depend on f0 previous ones, hence
+					// the segment continues the seam only after f0
+					// consecutive layers that did not change
+					below = diff <= tolerance ? below+1 : 0;
+					if (below == f0) {
+						break;
+					}
+				}
+				// the largest change over the last f0 re-generated layers
+				const int window = std::min(f0, int(diffs.size()));
+				discontinuity[s] = *std::max_element(diffs.end() - window, diffs.end());
+				if (part_stats) {
+					for (int t=std::max(first[s], stats_offset[0]); t<first[s]+seam[s]; ++t) {
+						for (int x=stats_offset[1]; x<x1; ++x) {
+							const T* row = data + t*layer + long(x)*y1;
+							parts[2*s].add(row + stats_offset[2], row + y1);
+						}
+					}
+				}
+			}
+		});
+
+		if (part_stats) {
+			part_stats->merge(merge_stats(parts));
+		}
+		segments.finish(zeta, t_begin, Segments::final_pass ? stats : nullptr, stats_offset);
+		Seam_stats result;
+		result.segments = n;
+		result.warmup = *std::max_element(prefix.begin(), prefix.end());
+		result.layers = *std::max_element(seam_layers.begin(), seam_layers.end());
+		result.discontinuity = *std::max_element(discontinuity.begin(), discontinuity.end());
+		return result;
+	}
+
+}
+
+#endif // SEGMENTS_HH
@@ -0,0 +1,396 @@
+#ifndef SEPARABLE_HH
+#define SEPARABLE_HH
+
+#include <algorithm>             // for max
+#include <cmath>                 // for abs
+#include <istream>               // for istream
+#include <limits>                // for numeric_limits
+#include <ostream>               // for ostream
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <vector>                // for vector
+
+#include <blitz/array.h>         // for Array, Range
+
+#include "parallel.hh"           // for parallel_for
+#include "stats.hh"              // for Stats, merge_stats
+#include "types.hh"              // for ACF, AR_coefs, Array1D, Zeta
+
+/// @file
+/// Yule-Walker equations for separable ACF.
+///
+/// If ACF is a product of three one-dimensional functions
+/// K(t,x,y) = K_t(t) K_x(x) K_y(y), then the autocovariance matrix is
+/// the Kronecker product A (x) B (x) C of three symmetric Toeplitz matrices.
+/// Let w be the solution of the full system R w = e_0. Removing the first
+/// equation (as in compute_AR_coefs) gives phi = -w_{1..N} / w_0, and
+/// w = A^{-1} e_0 (x) B^{-1} e_0 (x) C^{-1} e_0, so only three small
+/// one-dimensional systems are solved (by Levinson-Durbin recursion).
+
+namespace autoreg {
+
+	/// Method of solving Yule-Walker equations.
+	enum YW_solver {
+		/// Kronecker if ACF is separable, dense or PCG otherwise
+		/// (depending on the size of the system).
+		YW_AUTO,
+		/// Dense LAPACK solver for the full autocovariance matrix.
+		YW_DENSE,
+		/// Kronecker factorisation (ACF is declared separable).
+		YW_KRONECKER,
+		/// Matrix-free preconditioned conjugate gradient method.
+		YW_PCG
+	};
+
+	inline std::istream&
+	operator>>(std::istream& in, YW_solver& rhs) {
+		std::string name;
+		in >> name;
+		if (name == "auto") rhs = YW_AUTO;
+		else if (name == "dense") rhs = YW_DENSE;
+		else if (name == "kronecker") rhs = YW_KRONECKER;
+		else if (name == "pcg") rhs = YW_PCG;
+		else throw std::runtime_error("Unknown Yule-Walker solver: " + name);
+		return in;
+	}
+
+	inline std::ostream&
+	operator<<(std::ostream& out, YW_solver rhs) {
+		switch (rhs) {
+			case YW_AUTO: out << "auto"; break;
+			case YW_DENSE: out << "dense"; break;
+			case YW_KRONECKER: out << "kronecker"; break;
+			case YW_PCG: out << "pcg"; break;
+		}
+		return out;
+	}
+
+	/// Algorithm of wavy surface generation.
+	enum AR_generator {
+		/// Separable if ACF is separable, full otherwise.
+		GENERATOR_AUTO,
+		/// Three-dimensional AR filter (generate_zeta).
+		GENERATOR_FULL,
+		/// Three cascaded one-dimensional recursive filters.
+		GENERATOR_SEPARABLE
+	};
+
+	inline std::istream&
+	operator>>(std::istream& in, AR_generator& rhs) {
+		std::string name;
+		in >> name;
+		if (name == "auto") rhs = GENERATOR_AUTO;
+		else if (name == "full") rhs = GENERATOR_FULL;
+		else if (name == "separable") rhs = GENERATOR_SEPARABLE;
+		else throw std::runtime_error("Unknown generator: " + name);
+		return in;
+	}
+
+	inline std::ostream&
+	operator<<(std::ostream& out, AR_generator rhs) {
+		switch (rhs) {
+			case GENERATOR_AUTO: out << "auto"; break;
+			case GENERATOR_FULL: out << "full"; break;
+			case GENERATOR_SEPARABLE: out << "separable"; break;
+		}
+		return out;
+	}
+
+	/// One-dimensional factor of separable ACF along dimension @dim,
+	/// normalised so that the product of the factors equals ACF.
+	template<class T>
+	Array1D<T>
+	acf_factor(const ACF<T>& acf, int dim) {
+		const int n = acf.extent(dim);
+		Array1D<T> factor(n);
+		const T scale = dim == 0 ? T(1) : acf(0,0,0);
+		for (int i=0; i<n; ++i) {
+			size3 idx(0, 0, 0);
+			idx(dim) = i;
+			factor(i) = acf(idx) / scale;
+		}
+		return factor;
+	}
+
+	/// Check that ACF equals the product of its one-dimensional factors
+	/// with relative tolerance @eps.
+	template<class T>
+	bool
+	is_separable(const ACF<T>& acf, T eps = T(100)*std::numeric_limits<T>::epsilon()) {
+		const T acf0 = acf(0,0,0);
+		if (!(std::abs(acf0) > T(0))) {
+			return false;
+		}
+		const Array1D<T> kt = acf_factor(acf, 0);
+		const Array1D<T> kx = acf_factor(acf, 1);
+		const Array1D<T> ky = acf_factor(acf, 2);
+		const int t1 = acf.extent(0);
+		const int x1 = acf.extent(1);
+		const int y1 = acf.extent(2);
+		for (int t=0; t<t1; ++t) {
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					const T err = acf(t,x,y) - kt(t)*kx(x)*ky(y);
+					if (!(std::abs(err) <= eps*std::abs(acf0))) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	/// Levinson-Durbin recursion for symmetric Toeplitz system with the
+	/// first column @r. Returns the first column of the inverse matrix
+	/// divided by its first element, i.e. the prediction error filter
+	/// a = (1, -alpha_1, ..., -alpha_p) of the one-dimensional AR process.
+	/// @var is set to the prediction error variance, @variances (if not
+	/// empty) to the variances of all orders from 0 to n-1.
+	template<class T>
+	Array1D<T>
+	levinson_durbin(const Array1D<T>& r, T& var, std::vector<T>* variances = nullptr) {
+		const int n = r.extent(0);
+		Array1D<T> a(n), tmp(n);
+		a = 0;
+		a(0) = 1;
+		var = r(0);
+		if (!(var > T(0))) {
+			throw std::runtime_error("ACF variance is not positive");
+		}
+		if (variances) {
+			variances->assign(1, var);
+		}
+		for (int k=1; k<n; ++k) {
+			T acc = r(k);
+			for (int j=1; j<k; ++j) {
+				acc += a(j)*r(k-j);
+			}
+			const T refl = -acc / var;
+			for (int j=1; j<k; ++j) {
+				tmp(j) = a(j) + refl*a(k-j);
+			}
+			for (int j=1; j<k; ++j) {
+				a(j) = tmp(j);
+			}
+			a(k) = refl;
+			var *= T(1) - refl*refl;
+			if (!(var > T(0))) {
+				throw std::runtime_error("Toeplitz matrix is not positive definite");
+			}
+			if (variances) {
+				variances->push_back(var);
+			}
+		}
+		return a;
+	}
+
+	/// Prediction error filters of all three dimensions.
+	template<class T>
+	struct Separable_AR {
+		Array1D<T> filter[3];
+		/// Product of one-dimensional prediction error variances,
+		/// i.e. white noise variance of the three-dimensional process.
+		T variance = 1;
+	};
+
+	template<class T>
+	Separable_AR<T>
+	separable_AR_filters(const ACF<T>& acf) {
+		Separable_AR<T> result;
+		for (int i=0; i<3; ++i) {
+			T var = 0;
+			result.filter[i].reference(levinson_durbin(acf_factor(acf, i), var));
+			result.variance *= var;
+		}
+		return result;
+	}
+
+	/// AR coefficients of separable process: phi = -a (x) b (x) c, phi(0,0,0) = 0.
+	template<class T>
+	AR_coefs<T>
+	compute_AR_coefs_separable(const ACF<T>& acf) {
+		const Separable_AR<T> ar = separable_AR_filters(acf);
+		AR_coefs<T> phi(acf.shape());
+		const int t1 = acf.extent(0);
+		const int x1 = acf.extent(1);
+		const int y1 = acf.extent(2);
+		for (int t=0; t<t1; ++t) {
+			for (int x=0; x<x1; ++x) {
+				for (int y=0; y<y1; ++y) {
+					phi(t,x,y) = -ar.filter[0](t)*ar.filter[1](x)*ar.filter[2](y);
+				}
+			}
+		}
+		phi(0,0,0) = 0;
+		return phi;
+	}
+
+	/// Separable generator is used only for separable ACF,
+	/// otherwise the full three-dimensional filter is the fallback.
+	template<class T>
+	AR_generator
+	choose_generator(const ACF<T>& acf, AR_generator generator) {
+		if (generator != GENERATOR_FULL) {
+			generator = is_separable(acf) ? GENERATOR_SEPARABLE : GENERATOR_FULL;
+		}
+		return generator;
+	}
+
+	/// Filter along t of generate_zeta_separable applied to layers
+	/// [@t_begin, end) of @zeta. The previous layers are the history that
+	/// has been filtered along t only.
+	template<class T>
+	void
+	separable_filter_t(
+		const Separable_AR<T>& ar,
+		Zeta<T>& zeta,
+		const T scale = T(1),
+		const int t_begin = 0
+	) {
+		if (zeta.stride(2) != 1) {
+			throw std::runtime_error("zeta is not contiguous along y");
+		}
+		const int t1 = zeta.extent(0);
+		const int x1 = zeta.extent(1);
+		const int y1 = zeta.extent(2);
+		const long s0 = zeta.stride(0);
+		const long s1 = zeta.stride(1);
+		T* base = zeta.data();
+		std::vector<T> a(ar.filter[0].begin(), ar.filter[0].end());
+		const int f0 = a.size();
+
+		// along t
+		parallel_for(0, x1, [&] (int x_begin, int x_end) {
+			for (int t=t_begin; t<t1; t++) {
+				const int m = std::min(t+1, f0);
+				for (int x=x_begin; x<x_end; x++) {
+					T* row = base + t*s0 + x*s1;
+					for (int y=0; y<y1; y++) {
+						row[y] *= scale;
+					}
+					for (int k=1; k<m; k++) {
+						const T ak = a[k];
+						const T* prev = row - k*s0;
+						for (int y=0; y<y1; y++) {
+							row[y] -= ak*prev[y];
+						}
+					}
+				}
+			}
+		});
+	}
+
+	/// Filters along x and y of generate_zeta_separable applied to layers
+	/// [@t_begin, end) of @zeta.
+	template<class T>
+	void
+	separable_filter_xy(
+		const Separable_AR<T>& ar,
+		Zeta<T>& zeta,
+		const int block = 64,
+		Stats<T>* stats = nullptr,
+		const size3& stats_offset = size3(0,0,0),
+		const int t_begin = 0
+	) {
+		if (zeta.stride(2) != 1) {
+			throw std::runtime_error("zeta is not contiguous along y");
+		}
+		const int t1 = zeta.extent(0);
+		const int x1 = zeta.extent(1);
+		const int y1 = zeta.extent(2);
+		const long s0 = zeta.stride(0);
+		const long s1 = zeta.stride(1);
+		T* base = zeta.data();
+		std::vector<T> b(ar.filter[1].begin(), ar.filter[1].end());
+		std::vector<T> c(ar.filter[2].begin(), ar.filter[2].end());
+		const int f1 = b.size();
+		const int f2 = c.size();
+
+		// along x
+		parallel_for(t_begin, t1, [&] (int first, int last) {
+			for (int t=first; t<last; t++) {
+				for (int x=1; x<x1; x++) {
+					const int m = std::min(x+1, f1);
+					T* row = base + t*s0 + x*s1;
+					for (int i=1; i<m; i++) {
+						const T bi = b[i];
+						const T* prev = row - i*s1;
+						for (int y=0; y<y1; y++) {
+							row[y] -= bi*prev[y];
+						}
+					}
+				}
+			}
+		});
+
+		// along y; statistics of each layer are merged in the order of layers,
+		// so that the result does not depend on the order of threads
+		const int bx = std::max(1, std::min(block, x1));
+		std::vector<Stats<T>> parts(stats ? std::max(t1 - t_begin, 0) : 0,
+			stats ? stats->empty() : Stats<T>());
+		parallel_for(t_begin, t1, [&] (int first, int last) {
+			std::vector<T> buf(long(bx)*y1);
+			for (int t=first; t<last; t++) {
+				for (int x0=0; x0<x1; x0+=bx) {
+					const int nx = std::min(bx, x1-x0);
+					T* plane = base + t*s0 + x0*s1;
+					for (int x=0; x<nx; x++) {
+						for (int y=0; y<y1; y++) {
+							buf[long(y)*nx + x] = plane[x*s1 + y];
+						}
+					}
+					for (int y=1; y<y1; y++) {
+						const int m = std::min(y+1, f2);
+						T* col = &buf[long(y)*nx];
+						for (int j=1; j<m; j++) {
+							const T cj = c[j];
+							const T* prev = col - long(j)*nx;
+							for (int x=0; x<nx; x++) {
+								col[x] -= cj*prev[x];
+							}
+						}
+					}
+					for (int x=0; x<nx; x++) {
+						for (int y=0; y<y1; y++) {
+							plane[x*s1 + y] = buf[long(y)*nx + x];
+						}
+						if (stats && t >= stats_offset[0] && x0+x >= stats_offset[1]) {
+							parts[t - t_begin].add(plane + x*s1 + stats_offset[2], plane + x*s1 + y1);
+						}
+					}
+				}
+			}
+		});
+		if (stats && !parts.empty()) {
+			stats->merge(merge_stats(parts));
+		}
+	}
+
+	/// Generate wavy surface from white noise in @zeta with three cascaded
+	/// one-dimensional recursive filters along t, x and y. The result equals
+	/// to that of generate_zeta with coefficients from compute_AR_coefs_separable,
+	/// but the cost per point is f0+f1+f2 instead of f0*f1*f2 multiply-adds.
+	///
+	/// Filters along t and x are applied to whole rows, so the innermost loop
+	/// runs over neighbouring lines and is vectorised. Filter along y is
+	/// applied to transposed time slice for the same reason; the slice is
+	/// transposed by blocks of @block rows to fit in cache.
+	/// Statistics of the points with indices not less than @stats_offset are
+	/// accumulated in @stats after the last pass.
+	template<class T>
+	void
+	generate_zeta_separable(
+		const Separable_AR<T>& ar,
+		Zeta<T>& zeta,
+		const T scale = T(1),
+		const int block = 64,
+		Stats<T>* stats = nullptr,
+		const size3& stats_offset = size3(0,0,0)
+	) {
+		separable_filter_t(ar, zeta, scale);
+		separable_filter_xy(ar, zeta, block, stats, stats_offset);
+	}
+
+}
+
+#endif // SEPARABLE_HH
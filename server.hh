@@ -0,0 +1,460 @@
+#ifndef SERVER_HH
+#define SERVER_HH
+
+#include <algorithm>             // for sort, min
+#include <atomic>                // for atomic
+#include <chrono>                // for steady_clock, duration_cast
+#include <condition_variable>    // for condition_variable
+#include <cstring>               // for strerror, memset, strncpy
+#include <deque>                 // for deque
+#include <fstream>               // for ofstream
+#include <iostream>              // for clog, endl
+#include <memory>                // for shared_ptr, make_shared, unique_ptr
+#include <mutex>                 // for mutex, lock_guard, unique_lock
+#include <sstream>               // for stringstream
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <thread>                // for thread
+#include <vector>                // for vector
+
+#include <cerrno>                // for errno
+#include <sys/socket.h>          // for socket, bind, listen, accept, send
+#include <sys/stat.h>            // for lstat, chmod, umask
+#include <sys/un.h>              // for sockaddr_un
+#include <unistd.h>              // for close, read, unlink
+
+#include "autoreg.hh"            // for read_mt_configs
+#include "autoreg_driver.hh"     // for Autoreg_model, Fit_cache
+#include "parallel.hh"           // for parallel_threads
+#include "thread_pool.hh"        // for Blas_threads
+#include "sink.hh"               // for Zeta_sink, Zeta_text_sink
+
+/// @file
+/// Resident generator that accepts requests over UNIX socket.
+///
+/// Request is a list of model parameters in the same format as autoreg.model
+/// terminated by an empty line or end of stream. If the request contains
+/// "output=file", the surface is written to the file on the server side
+/// and the reply is "ok <milliseconds>", otherwise the surface is sent back
+/// in text format. Request "stats" returns server metrics. Errors are
+/// reported as "error: <message>".
+///
+/// The socket is accessible only by the owner of the server. Files named
+/// in requests (output, checkpoint, analysis) are created with the server's
+/// privileges, hence they must be plain names and are placed in the output
+/// directory of the server; without the directory such requests are
+/// refused, as well as shared memory output.
+///
+/// ACF and AR coefficients are cached between requests with the same
+/// parameters, MT configurations and host profile are read only once.
+
+namespace autoreg {
+
+	inline std::runtime_error
+	socket_error(const std::string& what) {
+		return std::runtime_error(what + ": " + std::strerror(errno));
+	}
+
+	inline sockaddr_un
+	unix_address(const std::string& path) {
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path)) {
+			throw std::runtime_error("socket path is too long: " + path);
+		}
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+		return addr;
+	}
+
+	inline void
+	write_all(int fd, const char* data, size_t n) {
+		while (n > 0) {
+			const ssize_t ret = ::send(fd, data, n, MSG_NOSIGNAL);
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				throw socket_error("send");
+			}
+			data += ret;
+			n -= ret;
+		}
+	}
+
+	/// Read request text until empty line or end of stream.
+	inline std::string
+	read_request(int fd) {
+		std::string request;
+		char buf[4096];
+		while (true) {
+			const ssize_t ret = ::read(fd, buf, sizeof(buf));
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				throw socket_error("read");
+			}
+			if (ret == 0) break;
+			request.append(buf, ret);
+			const size_t pos = request.find("\n\n");
+			if (pos != std::string::npos) {
+				request.resize(pos+1);
+				break;
+			}
+		}
+		return request;
+	}
+
+	/// Sends surface in text format to the socket slab by slab,
+	/// so that the whole reply is never stored in memory.
+	template<class T>
+	struct Socket_sink: public Zeta_sink<T> {
+
+		explicit
+		Socket_sink(int fd):
+		_fd(fd),
+		_text(_buffer)
+		{}
+
+		void
+		begin(const size3& zsize, const Vec3<T>& zdelta) override {
+			_text.begin(zsize, zdelta);
+			flush();
+		}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			_text.consume(slab, t);
+			flush();
+		}
+
+		void
+		end() override {
+			_text.end();
+			flush();
+		}
+
+		/// True if some data was sent.
+		bool started() const { return _started; }
+
+	private:
+		void
+		flush() {
+			const std::string str = _buffer.str();
+			write_all(_fd, str.data(), str.size());
+			_buffer.str("");
+			_started = true;
+		}
+
+		int _fd;
+		std::stringstream _buffer;
+		Zeta_text_sink<T> _text;
+		bool _started = false;
+	};
+
+	/// Request latencies and other metrics. Latency is measured from the
+	/// moment a server worker takes the connection, the time the connection
+	/// waited for a free worker is reported separately.
+	class Server_stats {
+
+	public:
+		void
+		add(double milliseconds, double queue_milliseconds, double points, bool ok) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_queue_wait += queue_milliseconds;
+			_queue_wait_max = std::max(_queue_wait_max, queue_milliseconds);
+			if (!ok) {
+				++_failures;
+				return;
+			}
+			_latencies.push_back(milliseconds);
+			_points += points;
+			_seconds += milliseconds * 1e-3;
+		}
+
+		void
+		write(std::ostream& out, size_t cache_hits, size_t cache_misses) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			std::vector<double> lat(_latencies);
+			std::sort(lat.begin(), lat.end());
+			double mean = 0;
+			for (double x : lat) mean += x;
+			if (!lat.empty()) mean /= lat.size();
+			out << "requests=" << lat.size() + _failures << '\n';
+			out << "failures=" << _failures << '\n';
+			out << "latency_mean_ms=" << mean << '\n';
+			out << "latency_p50_ms=" << percentile(lat, 0.50) << '\n';
+			out << "latency_p95_ms=" << percentile(lat, 0.95) << '\n';
+			out << "latency_max_ms=" << (lat.empty() ? 0 : lat.back()) << '\n';
+			const size_t nrequests = lat.size() + _failures;
+			out << "queue_wait_mean_ms=" << (nrequests > 0 ? _queue_wait/nrequests : 0) << '\n';
+			out << "queue_wait_max_ms=" << _queue_wait_max << '\n';
+			out << "points_per_second=" << (_seconds > 0 ? _points/_seconds : 0) << '\n';
+			out << "cache_hits=" << cache_hits << '\n';
+			out << "cache_misses=" << cache_misses << '\n';
+		}
+
+	private:
+		static double
+		percentile(const std::vector<double>& sorted, double p) {
+			if (sorted.empty()) return 0;
+			const size_t i = std::min(sorted.size()-1, size_t(p*sorted.size()));
+			return sorted[i];
+		}
+
+		std::vector<double> _latencies;
+		size_t _failures = 0;
+		double _queue_wait = 0;
+		double _queue_wait_max = 0;
+		double _points = 0;
+		double _seconds = 0;
+		std::mutex _mutex;
+	};
+
+	template<class T>
+	class Autoreg_server {
+
+	public:
+		/// @nworkers number of concurrently processed requests.
+		Autoreg_server(const std::string& path, int nworkers):
+		_path(path),
+		_nworkers(std::max(1, nworkers)),
+		_mt_configs(std::make_shared<std::vector<mt_config>>(read_mt_configs("init_data")))
+		{
+			std::ifstream profile(profile_filename());
+			if (profile.is_open()) {
+				std::stringstream str;
+				str << profile.rdbuf() << '\n';
+				_profile = str.str();
+			}
+			// thread settings are global, they are set once from the profile:
+			// LAPACK results depend on the number of BLAS threads, and
+			// concurrent requests would change it for each other
+			Autoreg_model<T> defaults;
+			std::stringstream in(_profile);
+			in >> defaults;
+			if (defaults.nthreads > 0) {
+				parallel_threads() = defaults.nthreads;
+			}
+			const int width = parallel_threads();
+			_blas.reset(new Blas_threads(width - std::min(width, defaults.noise_threads)));
+		}
+
+		/// File where metrics are written after each request (optional).
+		void metrics_file(const std::string& filename) { _metrics_file = filename; }
+
+		/// Directory for files named in requests (optional).
+		void output_dir(const std::string& dir) { _output_dir = dir; }
+
+		/// Accept connections until the process is terminated.
+		void
+		run() {
+			const int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (sock < 0) {
+				throw socket_error("socket");
+			}
+			const sockaddr_un addr = unix_address(_path);
+			// only a stale socket of the previous server is replaced
+			struct stat st;
+			if (::lstat(_path.c_str(), &st) == 0) {
+				if (!S_ISSOCK(st.st_mode)) {
+					::close(sock);
+					throw std::runtime_error(_path + " exists and is not a socket");
+				}
+				::unlink(_path.c_str());
+			}
+			// other users should not be able to connect
+			const mode_t mask = ::umask(077);
+			const int ret = ::bind(sock, (const sockaddr*)&addr, sizeof(addr));
+			::umask(mask);
+			if (ret < 0 || ::chmod(_path.c_str(), 0600) < 0) {
+				::close(sock);
+				throw socket_error("bind " + _path);
+			}
+			if (::listen(sock, 64) < 0) {
+				::close(sock);
+				throw socket_error("listen");
+			}
+			std::clog << "listening on " << _path
+				<< " with " << _nworkers << " workers" << std::endl;
+			std::vector<std::thread> workers;
+			for (int i=0; i<_nworkers; ++i) {
+				workers.emplace_back([this] () { this->work(); });
+			}
+			while (true) {
+				const int fd = ::accept(sock, nullptr, nullptr);
+				if (fd < 0) {
+					if (errno == EINTR) continue;
+					std::clog << "accept: " << std::strerror(errno) << std::endl;
+					continue;
+				}
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					_connections.push_back(Connection{fd, std::chrono::steady_clock::now()});
+				}
+				_cv.notify_one();
+			}
+		}
+
+	private:
+		void
+		work() {
+			while (true) {
+				Connection conn;
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_cv.wait(lock, [this] () { return !_connections.empty(); });
+					conn = _connections.front();
+					_connections.pop_front();
+				}
+				const int fd = conn.fd;
+				try {
+					serve(fd, conn.accepted);
+				} catch (const std::exception& err) {
+					std::lock_guard<std::mutex> lock(_log_mutex);
+					std::clog << "error: " << err.what() << std::endl;
+				}
+				::close(fd);
+			}
+		}
+
+		void
+		serve(int fd, std::chrono::steady_clock::time_point accepted) {
+			const auto dequeued = std::chrono::steady_clock::now();
+			const double queue_ms = std::chrono::duration<double,std::milli>(dequeued - accepted).count();
+			const std::string request = read_request(fd);
+			if (request.compare(0, 5, "stats") == 0) {
+				std::stringstream reply;
+				_stats.write(reply, _cache.hits(), _cache.misses());
+				const std::string str = reply.str();
+				write_all(fd, str.data(), str.size());
+				return;
+			}
+			const auto t0 = std::chrono::steady_clock::now();
+			std::stringstream log;
+			std::stringstream reply;
+			Socket_sink<T> sink(fd);
+			double points = 0;
+			bool ok = true;
+			try {
+				Autoreg_model<T> model;
+				model.output.clear();
+				model.log_stream = &log;
+				model.mt_configs = _mt_configs;
+				model.fit_cache = &_cache;
+				model.fixed_threads = true;
+				// parameters from the request override tuned ones
+				std::stringstream in(_profile + request);
+				in >> model;
+				confine_files(model);
+				points = model.num_points();
+				if (model.output.empty()) {
+					model.act(sink);
+				} else {
+					model.act();
+					const auto t1 = std::chrono::steady_clock::now();
+					reply << "ok " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << '\n';
+				}
+			} catch (const std::exception& err) {
+				ok = false;
+				reply.str("");
+				reply << "error: " << err.what() << '\n';
+				log << "error: " << err.what() << '\n';
+			}
+			const auto t1 = std::chrono::steady_clock::now();
+			const double ms = std::chrono::duration<double,std::milli>(t1 - t0).count();
+			_stats.add(ms, queue_ms, points, ok);
+			{
+				std::lock_guard<std::mutex> lock(_log_mutex);
+				std::clog << log.str() << std::flush;
+				if (!_metrics_file.empty()) {
+					std::ofstream metrics(_metrics_file);
+					_stats.write(metrics, _cache.hits(), _cache.misses());
+				}
+			}
+			// if the surface was partially sent, the error is appended to it
+			const std::string str = reply.str();
+			if (!(ok && sink.started())) {
+				write_all(fd, str.data(), str.size());
+			}
+		}
+
+		/// Refuse shared memory output and place files of the request
+		/// in the output directory.
+		void
+		confine_files(Autoreg_model<T>& model) const {
+			if (!model.shm.empty()) {
+				throw std::runtime_error("shm is not allowed in server requests");
+			}
+			if (model.output != "none") {
+				confine_file(model.output, "output");
+			}
+			confine_file(model.checkpoint, "checkpoint");
+			confine_file(model.analysis, "analysis");
+		}
+
+		void
+		confine_file(std::string& name, const char* key) const {
+			if (name.empty()) {
+				return;
+			}
+			if (_output_dir.empty()) {
+				throw std::runtime_error(std::string(key) + " is not allowed: server has no output directory");
+			}
+			if (name.find('/') != std::string::npos || name == "." || name == "..") {
+				throw std::runtime_error(std::string(key) + " should be a file name without directories");
+			}
+			name = _output_dir + '/' + name;
+		}
+
+		std::string _path;
+		int _nworkers;
+		std::string _metrics_file;
+		std::string _output_dir;
+		/// Contents of the host profile file.
+		std::string _profile;
+		std::shared_ptr<const std::vector<mt_config>> _mt_configs;
+		Fit_cache<T> _cache;
+		std::unique_ptr<Blas_threads> _blas;
+		Server_stats _stats;
+		struct Connection {
+			int fd;
+			std::chrono::steady_clock::time_point accepted;
+		};
+
+		std::deque<Connection> _connections;
+		std::mutex _mutex;
+		std::condition_variable _cv;
+		std::mutex _log_mutex;
+	};
+
+	/// Send request from @in to the server and copy the reply to @out.
+	inline void
+	send_request(const std::string& path, std::istream& in, std::ostream& out) {
+		const int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock < 0) {
+			throw socket_error("socket");
+		}
+		const sockaddr_un addr = unix_address(path);
+		if (::connect(sock, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+			::close(sock);
+			throw socket_error("connect " + path);
+		}
+		std::stringstream request;
+		request << in.rdbuf();
+		const std::string str = request.str();
+		write_all(sock, str.data(), str.size());
+		::shutdown(sock, SHUT_WR);
+		char buf[4096];
+		ssize_t ret;
+		while ((ret = ::read(sock, buf, sizeof(buf))) != 0) {
+			if (ret < 0) {
+				if (errno == EINTR) continue;
+				::close(sock);
+				throw socket_error("read");
+			}
+			out.write(buf, ret);
+		}
+		::close(sock);
+	}
+
+}
+
+#endif // SERVER_HH
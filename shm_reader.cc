@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_ring.hh"
+
+/// @file
+/// Reads time layers of wavy surface published by autoreg in shared memory
+/// (parameter shm in autoreg.model) and reports latency (the time between
+/// publication and reading of a frame) and jitter (standard deviation of the
+/// interval between frames).
+///
+/// Usage: shm_reader [-d] [-w SECONDS] NAME
+/// -d  values are double precision (single precision by default)
+/// -w  wait for the segment to appear (10 seconds by default)
+
+using namespace autoreg;
+
+double
+percentile(std::vector<double>& v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	const size_t k = std::min(v.size()-1, size_t(p*v.size()));
+	std::nth_element(v.begin(), v.begin()+k, v.end());
+	return v[k];
+}
+
+template<class T>
+void
+read_frames(const std::string& name, double wait) {
+	// the producer creates the segment when generation starts
+	const auto deadline = std::chrono::steady_clock::now()
+		+ std::chrono::microseconds(long(wait*1e6));
+	std::unique_ptr<Shm_ring_reader<T>> reader;
+	while (!reader) {
+		try {
+			reader.reset(new Shm_ring_reader<T>(name));
+		} catch (const std::exception& err) {
+			if (std::chrono::steady_clock::now() > deadline) {
+				throw;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	const size3 shape = reader->shape();
+	std::vector<double> latency, interval;
+	typename Shm_ring_reader<T>::Frame frame;
+	uint64_t nframes = 0, missed = 0, expected = 0;
+	int64_t prev = 0;
+	double checksum = 0;
+	const int64_t t0 = shm_now();
+	while (reader->next(frame)) {
+		const int64_t now = shm_now();
+		latency.push_back((now - frame.time)*1e-3);
+		if (nframes > 0) {
+			interval.push_back((now - prev)*1e-3);
+			missed += frame.seq - expected;
+		}
+		prev = now;
+		expected = frame.seq + 1;
+		// the consumer reads the frame in place
+		const long n = long(shape(1))*shape(2);
+		for (long i=0; i<n; ++i) {
+			checksum += frame.data[i];
+		}
+		if (!reader->valid(frame)) {
+			throw std::runtime_error("frame is overwritten while it is read");
+		}
+		reader->release();
+		++nframes;
+	}
+	const double seconds = (shm_now() - t0)*1e-9;
+	double mean_latency = 0;
+	for (double x : latency) mean_latency += x;
+	double mean_interval = 0;
+	for (double x : interval) mean_interval += x;
+	if (!latency.empty()) mean_latency /= latency.size();
+	if (!interval.empty()) mean_interval /= interval.size();
+	double jitter = 0;
+	for (double x : interval) jitter += (x - mean_interval)*(x - mean_interval);
+	if (!interval.empty()) jitter = std::sqrt(jitter / interval.size());
+	const double max_latency = latency.empty() ? 0
+		: *std::max_element(latency.begin(), latency.end());
+	const double bytes = double(nframes)*shape(1)*shape(2)*sizeof(T);
+	std::cout << "shape:      " << shape << '\n'
+		<< "frames:     " << nframes << " (missed " << missed << ")\n"
+		<< "latency:    mean=" << mean_latency
+		<< " p50=" << percentile(latency, 0.5)
+		<< " p99=" << percentile(latency, 0.99)
+		<< " max=" << max_latency << " us\n"
+		<< "interval:   mean=" << mean_interval << " jitter=" << jitter << " us\n"
+		<< "throughput: " << bytes / seconds / (1024*1024) << " MB/s\n"
+		<< "checksum:   " << checksum << std::endl;
+}
+
+int main(int argc, char** argv) {
+	bool dbl = false;
+	double wait = 10;
+	std::string name;
+	int n = 0;
+	for (int i=1; i<argc; ++i) {
+		const std::string ar = argv[i];
+		if (ar == "-d") dbl = true;
+		else if (ar == "-w" && i+1 < argc) wait = std::atof(argv[++i]);
+		else if (n++ == 0) name = ar;
+	}
+	if (n != 1) {
+		std::cerr << "usage: " << argv[0] << " [-d] [-w SECONDS] NAME" << std::endl;
+		return 1;
+	}
+	try {
+		if (dbl) read_frames<double>(name, wait);
+		else read_frames<float>(name, wait);
+	} catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,492 @@
+#ifndef SHM_RING_HH
+#define SHM_RING_HH
+
+#include <algorithm>             // for min, copy_n
+#include <atomic>                // for atomic
+#include <chrono>                // for steady_clock, nanoseconds
+#include <cstdint>               // for uint64_t, int64_t, uint32_t
+#include <cstring>               // for memcmp, memcpy, strerror
+#include <new>                   // for placement new
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <thread>                // for sleep_for
+#include <vector>                // for vector
+
+#include <cerrno>                // for errno
+#include <fcntl.h>               // for O_CREAT, O_RDWR
+#include <signal.h>              // for kill
+#include <sys/mman.h>            // for shm_open, mmap, munmap
+#include <unistd.h>              // for ftruncate, close, getpid
+
+#include "sink.hh"               // for Zeta_sink
+#include "types.hh"              // for Zeta, Array2D, size3, Vec3
+
+/// @file
+/// Ring buffer of time layers of wavy surface in POSIX shared memory.
+///
+/// The segment starts with a header (surface shape, grid granularity, ring
+/// capacity), followed by frame descriptors and frames (one time layer each,
+/// aligned by 64 bytes). The producer copies a layer to slot n % nframes,
+/// then stores sequence number n+1 in the descriptor of the slot and the
+/// number of published frames in the header. Each reader owns a cursor (the
+/// number of frames it has released); the producer does not overwrite frames
+/// that are not released by active readers and drops readers that do not
+/// advance for @timeout seconds. All indices are lock-free atomics, readers
+/// access frames in place without copying.
+///
+/// A dropped reader may still be reading a frame that the producer
+/// overwrites. Before a slot is overwritten its sequence number is reset
+/// to zero, so, as in a seqlock, the reader checks with valid() after
+/// using the frame that the frame was not changed in the meantime.
+
+namespace autoreg {
+
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64-bit atomics are not lock-free");
+
+	const int shm_max_readers = 8;
+	const uint64_t shm_inactive = ~uint64_t(0);
+	const uint32_t shm_version = 2;
+
+	/// Monotonic time in nanoseconds, the same in all processes.
+	inline int64_t
+	shm_now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	struct alignas(64) Shm_frame_info {
+		/// Sequence number of the frame in the slot plus one (0 if empty).
+		std::atomic<uint64_t> seq;
+		/// Publication time, @see shm_now.
+		int64_t time;
+		/// Time index of the layer.
+		int32_t t;
+	};
+
+	struct alignas(64) Shm_ring_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t value_size;
+		uint32_t nframes;
+		int32_t shape[3];
+		double delta[3];
+		/// Distance between frames in bytes.
+		uint64_t frame_stride;
+		/// Offset of the first frame descriptor and of the first frame.
+		uint64_t info_offset;
+		uint64_t data_offset;
+		/// Process id of the producer.
+		int32_t producer;
+		/// The number of published frames.
+		alignas(64) std::atomic<uint64_t> head;
+		std::atomic<uint32_t> finished;
+		/// The number of frames released by each reader
+		/// (shm_inactive if the cursor is free).
+		alignas(64) std::atomic<uint64_t> cursors[shm_max_readers];
+	};
+
+	inline std::runtime_error
+	shm_error(const std::string& what) {
+		return std::runtime_error(what + ": " + std::strerror(errno));
+	}
+
+	inline uint64_t
+	shm_round(uint64_t n) {
+		return (n + 63) / 64 * 64;
+	}
+
+	/// Publishes time layers of the surface in shared memory segment @name
+	/// (e.g. "/autoreg") with capacity of @nframes layers. The first frame
+	/// is published when @nreaders readers are connected (or after @timeout).
+	template<class T>
+	struct Zeta_shm_sink: public Zeta_sink<T> {
+
+		Zeta_shm_sink(const std::string& name, int nframes = 256, double timeout = 10,
+			int nreaders = 0):
+		_name(name),
+		_nframes(nframes),
+		_timeout(timeout),
+		_nreaders(nreaders)
+		{
+			if (nframes < 1) {
+				throw std::runtime_error("the number of frames < 1");
+			}
+		}
+
+		/// The segment is removed, connected readers keep their mappings.
+		~Zeta_shm_sink() {
+			if (_header) {
+				::munmap(_header, _size);
+				::shm_unlink(_name.c_str());
+			}
+		}
+
+		Zeta_shm_sink(const Zeta_shm_sink&) = delete;
+		Zeta_shm_sink& operator=(const Zeta_shm_sink&) = delete;
+
+		void
+		begin(const size3& zsize, const Vec3<T>& zdelta) override {
+			_frame_bytes = uint64_t(zsize(1))*zsize(2)*sizeof(T);
+			const uint64_t info_offset = shm_round(sizeof(Shm_ring_header));
+			const uint64_t data_offset = info_offset + shm_round(_nframes*sizeof(Shm_frame_info));
+			const uint64_t stride = shm_round(_frame_bytes);
+			_size = data_offset + _nframes*stride;
+			// the segment of a finished or crashed producer is replaced
+			if (producer_is_running(_name)) {
+				throw std::runtime_error("shared memory segment " + _name
+					+ " is used by another producer");
+			}
+			::shm_unlink(_name.c_str());
+			const int fd = ::shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+			if (fd < 0) {
+				throw shm_error("shm_open " + _name);
+			}
+			if (::ftruncate(fd, _size) != 0) {
+				::close(fd);
+				throw shm_error("ftruncate " + _name);
+			}
+			void* ptr = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (ptr == MAP_FAILED) {
+				throw shm_error("mmap " + _name);
+			}
+			char* base = static_cast<char*>(ptr);
+			_info = reinterpret_cast<Shm_frame_info*>(base + info_offset);
+			_data = base + data_offset;
+			for (uint32_t i=0; i<_nframes; ++i) {
+				new (_info + i) Shm_frame_info;
+				_info[i].seq.store(0);
+			}
+			Shm_ring_header* h = new (base) Shm_ring_header;
+			h->version = shm_version;
+			h->value_size = sizeof(T);
+			h->nframes = _nframes;
+			for (int i=0; i<3; ++i) {
+				h->shape[i] = zsize(i);
+				h->delta[i] = zdelta(i);
+			}
+			h->frame_stride = stride;
+			h->info_offset = info_offset;
+			h->data_offset = data_offset;
+			h->producer = ::getpid();
+			h->head.store(0);
+			h->finished.store(0);
+			for (int i=0; i<shm_max_readers; ++i) {
+				h->cursors[i].store(shm_inactive);
+			}
+			_last_cursor.assign(shm_max_readers, shm_inactive);
+			_last_change.assign(shm_max_readers, 0);
+			// readers check the magic after the header is initialised
+			std::atomic_thread_fence(std::memory_order_release);
+			std::memcpy(h->magic, "AUTOREG", 8);
+			_header = h;
+			const int64_t t0 = shm_now();
+			while (num_readers() < _nreaders && shm_now() - t0 < int64_t(_timeout*1e9)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			const int x1 = slab.extent(1);
+			const int y1 = slab.extent(2);
+			for (int i=0; i<slab.extent(0); ++i) {
+				const uint64_t n = _header->head.load(std::memory_order_relaxed);
+				wait_for_space(n);
+				const uint64_t slot = n % _nframes;
+				T* frame = reinterpret_cast<T*>(_data + slot*_header->frame_stride);
+				// readers of the old frame see that it is being overwritten
+				_info[slot].seq.store(0, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+				for (int x=0; x<x1; ++x) {
+					const T* row = &slab(i, x, 0);
+					if (slab.stride(2) == 1) {
+						std::copy_n(row, y1, frame + long(x)*y1);
+					} else {
+						for (int y=0; y<y1; ++y) {
+							frame[long(x)*y1 + y] = slab(i, x, y);
+						}
+					}
+				}
+				_info[slot].time = shm_now();
+				_info[slot].t = t + i;
+				_info[slot].seq.store(n + 1, std::memory_order_release);
+				_header->head.store(n + 1, std::memory_order_release);
+				++_frames;
+			}
+		}
+
+		void
+		end() override {
+			_header->finished.store(1, std::memory_order_release);
+		}
+
+		/// The number of published frames.
+		uint64_t frames() const { return _frames; }
+		/// The number of frames for which the producer waited for readers.
+		uint64_t waits() const { return _waits; }
+		/// Total wait time in seconds.
+		double wait_time() const { return _wait_time; }
+		/// The number of readers dropped after @timeout.
+		int dropped() const { return _dropped; }
+
+		/// The number of connected readers.
+		int
+		num_readers() const {
+			int n = 0;
+			for (int i=0; i<shm_max_readers; ++i) {
+				if (_header->cursors[i].load(std::memory_order_relaxed) != shm_inactive) {
+					++n;
+				}
+			}
+			return n;
+		}
+
+	private:
+		/// Whether segment @name exists and is being written by a process
+		/// that is still alive.
+		static bool
+		producer_is_running(const std::string& name) {
+			const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+			if (fd < 0) {
+				return false;
+			}
+			const off_t size = ::lseek(fd, 0, SEEK_END);
+			bool running = false;
+			if (size >= off_t(sizeof(Shm_ring_header))) {
+				void* ptr = ::mmap(nullptr, sizeof(Shm_ring_header), PROT_READ, MAP_SHARED, fd, 0);
+				if (ptr != MAP_FAILED) {
+					const Shm_ring_header* h = static_cast<const Shm_ring_header*>(ptr);
+					running = std::memcmp(h->magic, "AUTOREG", 8) == 0
+						&& h->version == shm_version
+						&& h->finished.load(std::memory_order_acquire) == 0
+						&& (::kill(h->producer, 0) == 0 || errno == EPERM);
+					::munmap(ptr, sizeof(Shm_ring_header));
+				}
+			}
+			::close(fd);
+			return running;
+		}
+
+		/// Wait until frame @n does not overwrite frames that are not
+		/// released by active readers.
+		void
+		wait_for_space(uint64_t n) {
+			if (n < _nframes) {
+				return;
+			}
+			const int64_t t0 = shm_now();
+			bool waited = false;
+			while (true) {
+				const int64_t now = shm_now();
+				bool full = false;
+				for (int i=0; i<shm_max_readers; ++i) {
+					uint64_t c = _header->cursors[i].load(std::memory_order_acquire);
+					if (c == shm_inactive) {
+						_last_cursor[i] = shm_inactive;
+						continue;
+					}
+					if (c != _last_cursor[i]) {
+						_last_cursor[i] = c;
+						_last_change[i] = now;
+					}
+					if (n - c < _nframes) {
+						continue;
+					}
+					if (now - _last_change[i] > int64_t(_timeout*1e9)
+						&& _header->cursors[i].compare_exchange_strong(c, shm_inactive))
+					{
+						++_dropped;
+						continue;
+					}
+					full = true;
+				}
+				if (!full) {
+					break;
+				}
+				waited = true;
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+			if (waited) {
+				++_waits;
+				_wait_time += (shm_now() - t0)*1e-9;
+			}
+		}
+
+		std::string _name;
+		uint32_t _nframes;
+		double _timeout;
+		int _nreaders;
+		Shm_ring_header* _header = nullptr;
+		Shm_frame_info* _info = nullptr;
+		char* _data = nullptr;
+		uint64_t _size = 0;
+		uint64_t _frame_bytes = 0;
+		std::vector<uint64_t> _last_cursor;
+		std::vector<int64_t> _last_change;
+		uint64_t _frames = 0;
+		uint64_t _waits = 0;
+		double _wait_time = 0;
+		int _dropped = 0;
+	};
+
+	/// Maps time layers published by Zeta_shm_sink in segment @name.
+	/// The reader starts from the next published frame.
+	template<class T>
+	class Shm_ring_reader {
+
+	public:
+		struct Frame {
+			/// Sequence number (from 0).
+			uint64_t seq = 0;
+			/// Time index of the layer.
+			int t = 0;
+			/// Publication time, @see shm_now.
+			int64_t time = 0;
+			/// Values of the layer in row-major order.
+			const T* data = nullptr;
+		};
+
+		explicit
+		Shm_ring_reader(const std::string& name) {
+			const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+			if (fd < 0) {
+				throw shm_error("shm_open " + name);
+			}
+			const off_t size = ::lseek(fd, 0, SEEK_END);
+			if (size < off_t(sizeof(Shm_ring_header))) {
+				::close(fd);
+				throw std::runtime_error("bad shared memory segment " + name);
+			}
+			void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (ptr == MAP_FAILED) {
+				throw shm_error("mmap " + name);
+			}
+			_size = size;
+			_header = static_cast<Shm_ring_header*>(ptr);
+			if (std::memcmp(_header->magic, "AUTOREG", 8) != 0
+				|| _header->version != shm_version
+				|| _header->value_size != sizeof(T))
+			{
+				::munmap(ptr, _size);
+				throw std::runtime_error("bad shared memory segment " + name);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			char* base = static_cast<char*>(ptr);
+			_info = reinterpret_cast<const Shm_frame_info*>(base + _header->info_offset);
+			_data = base + _header->data_offset;
+			for (_cursor=0; _cursor<shm_max_readers; ++_cursor) {
+				uint64_t expected = shm_inactive;
+				_next = _header->head.load(std::memory_order_acquire);
+				if (_header->cursors[_cursor].compare_exchange_strong(expected, _next)) {
+					break;
+				}
+			}
+			if (_cursor == shm_max_readers) {
+				::munmap(ptr, _size);
+				throw std::runtime_error("too many readers of " + name);
+			}
+		}
+
+		~Shm_ring_reader() {
+			uint64_t c = _header->cursors[_cursor].load();
+			if (c != shm_inactive) {
+				_header->cursors[_cursor].compare_exchange_strong(c, shm_inactive);
+			}
+			::munmap(_header, _size);
+		}
+
+		Shm_ring_reader(const Shm_ring_reader&) = delete;
+		Shm_ring_reader& operator=(const Shm_ring_reader&) = delete;
+
+		size3
+		shape() const {
+			return size3(_header->shape[0], _header->shape[1], _header->shape[2]);
+		}
+
+		Vec3<T>
+		delta() const {
+			return Vec3<T>(_header->delta[0], _header->delta[1], _header->delta[2]);
+		}
+
+		/// Wait for the next frame for at most @timeout seconds (forever if
+		/// negative). Returns false if there are no more frames or on timeout.
+		/// The frame stays valid until it is released, unless the reader is
+		/// dropped by the producer; check valid() after using the frame.
+		bool
+		next(Frame& frame, double timeout = -1) {
+			const int64_t t0 = shm_now();
+			while (_next >= _header->head.load(std::memory_order_acquire)) {
+				if (_header->finished.load(std::memory_order_acquire)
+					&& _next >= _header->head.load(std::memory_order_acquire))
+				{
+					return false;
+				}
+				check_active();
+				if (timeout >= 0 && shm_now() - t0 > int64_t(timeout*1e9)) {
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::microseconds(20));
+			}
+			check_active();
+			const uint64_t slot = _next % _header->nframes;
+			const Shm_frame_info& info = _info[slot];
+			if (info.seq.load(std::memory_order_acquire) != _next + 1) {
+				throw std::runtime_error("frame is overwritten");
+			}
+			frame.seq = _next;
+			frame.t = info.t;
+			frame.time = info.time;
+			frame.data = reinterpret_cast<const T*>(_data + slot*_header->frame_stride);
+			++_next;
+			return true;
+		}
+
+		/// Whether @frame has not been overwritten since it was returned
+		/// by next(), i.e. the values read from it are consistent.
+		bool
+		valid(const Frame& frame) const {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const Shm_frame_info& info = _info[frame.seq % _header->nframes];
+			return info.seq.load(std::memory_order_relaxed) == frame.seq + 1;
+		}
+
+		/// Frame as two-dimensional array without copying.
+		Array2D<T>
+		view(const Frame& frame) const {
+			return Array2D<T>(const_cast<T*>(frame.data),
+				blitz::shape(_header->shape[1], _header->shape[2]),
+				blitz::neverDeleteData);
+		}
+
+		/// Release all frames returned by next(), so that the producer
+		/// may overwrite them.
+		void
+		release() {
+			check_active();
+			uint64_t c = _header->cursors[_cursor].load(std::memory_order_relaxed);
+			_header->cursors[_cursor].compare_exchange_strong(c, _next,
+				std::memory_order_release);
+		}
+
+	private:
+		void
+		check_active() const {
+			if (_header->cursors[_cursor].load(std::memory_order_acquire) == shm_inactive) {
+				throw std::runtime_error("reader is dropped by producer");
+			}
+		}
+
+		Shm_ring_header* _header = nullptr;
+		const Shm_frame_info* _info = nullptr;
+		const char* _data = nullptr;
+		uint64_t _size = 0;
+		int _cursor = 0;
+		/// Sequence number of the next frame.
+		uint64_t _next = 0;
+	};
+
+}
+
+#endif // SHM_RING_HH
@@ -0,0 +1,280 @@
+#ifndef SINK_HH
+#define SINK_HH
+
+#include <algorithm>             // for min, max
+#include <fstream>               // for ofstream
+#include <functional>            // for function
+#include <ostream>               // for ostream, endl
+#include <sstream>               // for ostringstream
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <vector>                // for vector
+
+#include <blitz/array.h>         // for Array
+
+#include <fcntl.h>               // for open
+#include <unistd.h>              // for truncate, fsync
+
+#include "parallel.hh"           // for parallel_for
+#include "types.hh"              // for Zeta, size3, Vec3
+#include "zeta_io.hh"            // for Zeta_header
+
+/// @file
+/// Consumers of generated wavy surface.
+///
+/// Generator passes a sink read-only views of consecutive time slabs of the
+/// surface. Views reference generator buffers directly, i.e. no data is
+/// copied, and are valid only during the call.
+
+namespace autoreg {
+
+	template<class T>
+	struct Zeta_sink {
+
+		virtual ~Zeta_sink() {}
+
+		/// Called once before the first slab.
+		/// @zsize size of the whole surface, @zdelta grid granularity.
+		virtual void
+		begin(const size3& /*zsize*/, const Vec3<T>& /*zdelta*/) {}
+
+		/// Time layers [t, t + slab.extent(0)) of the surface.
+		virtual void
+		consume(const Zeta<T>& slab, int t) = 0;
+
+		/// Called once after the last slab.
+		virtual void
+		end() {}
+
+	};
+
+	/// Writes surface to the stream in the same text format as blitz.
+	/// Groups of rows of a slab are converted to text in parallel with
+	/// the formatting flags of the stream and are written in order.
+	template<class T>
+	struct Zeta_text_sink: public Zeta_sink<T> {
+
+		explicit
+		Zeta_text_sink(std::ostream& out):
+		_out(out)
+		{}
+
+		void
+		begin(const size3& zsize, const Vec3<T>&) override {
+			for (int i=0; i<3; ++i) {
+				_out << "(0," << zsize(i)-1 << ")";
+				if (i != 2) _out << " x ";
+			}
+			_out << std::endl << "[ ";
+		}
+
+		void
+		consume(const Zeta<T>& slab, int) override {
+			const int x1 = slab.extent(1);
+			const int y1 = slab.extent(2);
+			const long nrows = long(slab.extent(0))*x1;
+			// about 16K values per group
+			const long group = std::max(1, (1 << 14) / std::max(y1, 1));
+			const int ngroups = int((nrows + group - 1) / group);
+			_text.resize(ngroups);
+			parallel_for(0, ngroups, [&] (int first, int last) {
+				std::ostringstream str;
+				str.copyfmt(_out);
+				for (int g=first; g<last; ++g) {
+					str.str("");
+					for (long r=g*group; r<std::min(nrows, (g+1)*group); ++r) {
+						const int t = int(r / x1);
+						const int x = int(r % x1);
+						for (int y=0; y<y1; ++y) {
+							str << slab(t,x,y) << " ";
+						}
+						str << "\n  ";
+					}
+					_text[g] = str.str();
+				}
+			});
+			for (int g=0; g<ngroups; ++g) {
+				_out.write(_text[g].data(), _text[g].size());
+			}
+			_out.flush();
+		}
+
+		void
+		end() override {
+			_out << "]" << std::endl;
+			if (!_out) {
+				throw std::runtime_error("error writing zeta");
+			}
+		}
+
+	private:
+		std::ostream& _out;
+		/// Text of row groups of the current slab.
+		std::vector<std::string> _text;
+	};
+
+	/// Write the contents of the file (or directory) @path to disk.
+	inline void
+	sync_file(const std::string& path) {
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("unable to open " + path);
+		}
+		const int ret = ::fsync(fd);
+		::close(fd);
+		if (ret != 0) {
+			throw std::runtime_error("unable to sync " + path);
+		}
+	}
+
+	/// Writes surface to the file @filename in text format or, if @binary
+	/// is set, in binary format of zeta_io.hh (Zeta_header followed by the
+	/// values), which is read by Zeta_stream slice by slice.
+	template<class T>
+	struct Zeta_file_sink: public Zeta_sink<T> {
+
+		explicit
+		Zeta_file_sink(const std::string& filename, bool binary = false):
+		_filename(filename),
+		_file(filename, std::ios::binary),
+		_text(_file),
+		_binary(binary)
+		{
+			if (!_file.is_open()) {
+				throw std::runtime_error("unable to write " + filename);
+			}
+		}
+
+		/// Continue writing the file from @offset (e.g. after restart
+		/// from a checkpoint), the rest of the file is discarded.
+		/// begin() should not be called.
+		Zeta_file_sink(const std::string& filename, std::streamoff offset, bool binary = false):
+		_filename(filename),
+		_text(_file),
+		_binary(binary)
+		{
+			if (::truncate(filename.c_str(), offset) != 0) {
+				throw std::runtime_error("unable to truncate " + filename);
+			}
+			_file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+			if (!_file.is_open() || !_file.seekp(offset)) {
+				throw std::runtime_error("unable to write " + filename);
+			}
+		}
+
+		/// Write the file to disk and return the number of bytes written.
+		std::streamoff
+		sync() {
+			if (!_file.flush()) {
+				throw std::runtime_error("unable to write " + _filename);
+			}
+			sync_file(_filename);
+			return _file.tellp();
+		}
+
+		void
+		begin(const size3& zsize, const Vec3<T>& zdelta) override {
+			if (!_binary) {
+				_text.begin(zsize, zdelta);
+				return;
+			}
+			Zeta_header header;
+			header.value_size = sizeof(T);
+			for (int i=0; i<3; ++i) {
+				header.extent[i] = zsize(i);
+			}
+			_file.write((const char*)&header, sizeof(header));
+		}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			if (!_binary) {
+				_text.consume(slab, t);
+				return;
+			}
+			// slab is a view of the enlarged surface, hence row by row
+			const int y1 = slab.extent(2);
+			for (int i=0; i<slab.extent(0); ++i) {
+				for (int x=0; x<slab.extent(1); ++x) {
+					if (slab.stride(2) == 1) {
+						_file.write((const char*)&slab(i, x, 0), y1*sizeof(T));
+					} else {
+						for (int y=0; y<y1; ++y) {
+							_file.write((const char*)&slab(i, x, y), sizeof(T));
+						}
+					}
+				}
+			}
+			_file.flush();
+		}
+
+		void
+		end() override {
+			if (!_binary) {
+				_text.end();
+				return;
+			}
+			_file.flush();
+			if (!_file) {
+				throw std::runtime_error("error writing zeta");
+			}
+		}
+
+	private:
+		std::string _filename;
+		std::ofstream _file;
+		Zeta_text_sink<T> _text;
+		bool _binary;
+	};
+
+	/// Passes every slab to all @sinks in order.
+	template<class T>
+	struct Zeta_tee_sink: public Zeta_sink<T> {
+
+		explicit
+		Zeta_tee_sink(const std::vector<Zeta_sink<T>*>& sinks):
+		_sinks(sinks)
+		{}
+
+		void
+		begin(const size3& zsize, const Vec3<T>& zdelta) override {
+			for (Zeta_sink<T>* sink : _sinks) sink->begin(zsize, zdelta);
+		}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			for (Zeta_sink<T>* sink : _sinks) sink->consume(slab, t);
+		}
+
+		void
+		end() override {
+			for (Zeta_sink<T>* sink : _sinks) sink->end();
+		}
+
+	private:
+		std::vector<Zeta_sink<T>*> _sinks;
+	};
+
+	/// Calls @func(slab, t) for every slab.
+	template<class T>
+	struct Zeta_callback_sink: public Zeta_sink<T> {
+
+		typedef std::function<void (const Zeta<T>&, int)> function_type;
+
+		explicit
+		Zeta_callback_sink(function_type func):
+		_func(func)
+		{}
+
+		void
+		consume(const Zeta<T>& slab, int t) override {
+			_func(slab, t);
+		}
+
+	private:
+		function_type _func;
+	};
+
+}
+
+#endif // SINK_HH
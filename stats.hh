@@ -0,0 +1,170 @@
+#ifndef STATS_HH
+#define STATS_HH
+
+#include <algorithm>             // for min, max
+#include <cmath>                 // for isnan, isinf, floor, sqrt
+#include <cstddef>               // for size_t
+#include <limits>                // for numeric_limits
+#include <ostream>               // for ostream
+#include <vector>                // for vector
+
+/// @file
+/// Single-pass statistics of generated arrays.
+///
+/// Statistics are accumulated by generating kernels for each row right after
+/// the row is computed (while it is in cache), separately in each thread, and
+/// are merged at the end with the parallel formula of Chan et al. for
+/// the sum of squared deviations.
+
+namespace autoreg {
+
+	template<class T>
+	struct Stats {
+
+		/// Histogram has @nbins equal bins on [@lo,@hi),
+		/// values outside are counted in @underflow and @overflow.
+		Stats(double lo = -1, double hi = 1, int nbins = 0):
+		lo(lo),
+		hi(hi),
+		histogram(nbins, 0)
+		{}
+
+		/// Empty statistics with the same histogram bins.
+		Stats
+		empty() const {
+			return Stats(lo, hi, histogram.size());
+		}
+
+		/// Add one value (Welford's algorithm).
+		void
+		add(T x) {
+			add(&x, &x + 1);
+		}
+
+		/// Add values [@first,@last) that are contiguous in memory.
+		/// The range is processed in two passes, so it should fit in cache.
+		void
+		add(const T* first, const T* last) {
+			const int nbins = histogram.size();
+			const double scale = nbins / (hi - lo);
+			size_t n = 0;
+			double sum = 0;
+			for (const T* p=first; p!=last; ++p) {
+				const T x = *p;
+				if (std::isnan(x)) { ++nans; continue; }
+				if (std::isinf(x)) { ++infs; continue; }
+				++n;
+				sum += x;
+				min = std::min(min, x);
+				max = std::max(max, x);
+				if (nbins > 0) {
+					const double b = std::floor((x - lo)*scale);
+					if (b < 0) ++underflow;
+					else if (b >= nbins) ++overflow;
+					else ++histogram[int(b)];
+				}
+			}
+			if (n == 0) {
+				return;
+			}
+			const double m = sum / n;
+			double m2 = 0;
+			for (const T* p=first; p!=last; ++p) {
+				const double x = *p;
+				if (std::isfinite(x)) {
+					m2 += (x - m)*(x - m);
+				}
+			}
+			merge_moments(n, m, m2);
+		}
+
+		/// Merge statistics of another part of the array.
+		/// Both parts should have the same histogram bins.
+		void
+		merge(const Stats& rhs) {
+			nans += rhs.nans;
+			infs += rhs.infs;
+			min = std::min(min, rhs.min);
+			max = std::max(max, rhs.max);
+			underflow += rhs.underflow;
+			overflow += rhs.overflow;
+			for (size_t i=0; i<histogram.size() && i<rhs.histogram.size(); ++i) {
+				histogram[i] += rhs.histogram[i];
+			}
+			if (rhs.count > 0) {
+				merge_moments(rhs.count, rhs.mean, rhs.m2);
+			}
+		}
+
+		/// Unbiased variance estimate.
+		double
+		variance() const {
+			return count > 1 ? m2 / (count - 1) : 0;
+		}
+
+		bool
+		finite() const {
+			return nans == 0 && infs == 0;
+		}
+
+		/// Number of finite values.
+		size_t count = 0;
+		size_t nans = 0;
+		size_t infs = 0;
+		double mean = 0;
+		/// Sum of squared deviations from the mean.
+		double m2 = 0;
+		T min = std::numeric_limits<T>::max();
+		T max = std::numeric_limits<T>::lowest();
+		double lo;
+		double hi;
+		std::vector<size_t> histogram;
+		size_t underflow = 0;
+		size_t overflow = 0;
+
+	private:
+		void
+		merge_moments(size_t n, double m, double m2_rhs) {
+			const double total = double(count) + double(n);
+			const double delta = m - mean;
+			mean += delta * n / total;
+			m2 += m2_rhs + delta*delta * double(count) * double(n) / total;
+			count += n;
+		}
+	};
+
+	template<class T>
+	std::ostream&
+	operator<<(std::ostream& out, const Stats<T>& rhs) {
+		out << "mean=" << rhs.mean
+			<< " variance=" << rhs.variance()
+			<< " min=" << rhs.min
+			<< " max=" << rhs.max
+			<< " nan=" << rhs.nans
+			<< " inf=" << rhs.infs;
+		if (!rhs.histogram.empty()) {
+			out << " histogram=[" << rhs.lo << ',' << rhs.hi << "):"
+				<< rhs.underflow << '|';
+			for (size_t i=0; i<rhs.histogram.size(); ++i) {
+				if (i > 0) out << ',';
+				out << rhs.histogram[i];
+			}
+			out << '|' << rhs.overflow;
+		}
+		return out;
+	}
+
+	/// Statistics merged from per-thread parts.
+	template<class T>
+	Stats<T>
+	merge_stats(const std::vector<Stats<T>>& parts) {
+		Stats<T> result = parts.empty() ? Stats<T>() : parts.front();
+		for (size_t i=1; i<parts.size(); ++i) {
+			result.merge(parts[i]);
+		}
+		return result;
+	}
+
+}
+
+#endif // STATS_HH
@@ -1,9 +1,11 @@
 #ifndef SYSV_HH
 #define SYSV_HH
 
+#include <algorithm>  // for max
 #include <sstream>    // for operator<<, basic_ostream::operator<<, basic_os...
 #include <stdexcept>  // for invalid_argument
-#include <valarray>   // for valarray
+
+#include "memory.hh"  // for Arena_buffer
 
 /// @file
 /// C/C++ interface to ``sysv'' LAPACK routine.
@@ -24,23 +26,33 @@ check_info(int info) {
 	}
 }
 
+/// Workspace size is obtained by LAPACK query (lwork = -1),
+/// workspace and pivots are allocated in the arena.
 template<>
 void sysv<float>(char type, int m, int nrhs, float* a, int lda, float* b, int ldb) {
 	int info = 0;
-	int lwork = m;
-	std::valarray<float> work(lwork);
-	std::valarray<int> ipiv(m);
-	ssysv_(&type, &m, &nrhs, a, &lda, &ipiv[0], b, &ldb, &work[0], &lwork, &info);
+	int lwork = -1;
+	float optimal = 0;
+	autoreg::Arena_buffer<int> ipiv(m);
+	ssysv_(&type, &m, &nrhs, a, &lda, ipiv.data(), b, &ldb, &optimal, &lwork, &info);
+	check_info(info);
+	lwork = std::max(1, int(optimal));
+	autoreg::Arena_buffer<float> work(lwork);
+	ssysv_(&type, &m, &nrhs, a, &lda, ipiv.data(), b, &ldb, work.data(), &lwork, &info);
 	check_info(info);
 }
 
 template<>
 void sysv<double>(char type, int m, int nrhs, double* a, int lda, double* b, int ldb) {
 	int info = 0;
-	int lwork = m;
-	std::valarray<double> work(lwork);
-	std::valarray<int> ipiv(m);
-	dsysv_(&type, &m, &nrhs, a, &lda, &ipiv[0], b, &ldb, &work[0], &lwork, &info);
+	int lwork = -1;
+	double optimal = 0;
+	autoreg::Arena_buffer<int> ipiv(m);
+	dsysv_(&type, &m, &nrhs, a, &lda, ipiv.data(), b, &ldb, &optimal, &lwork, &info);
+	check_info(info);
+	lwork = std::max(1, int(optimal));
+	autoreg::Arena_buffer<double> work(lwork);
+	dsysv_(&type, &m, &nrhs, a, &lda, ipiv.data(), b, &ldb, work.data(), &lwork, &info);
 	check_info(info);
 }
 
@@ -0,0 +1,289 @@
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <algorithm>             // for max
+#include <atomic>                // for atomic
+#include <chrono>                // for milliseconds
+#include <condition_variable>    // for condition_variable
+#include <deque>                 // for deque
+#include <exception>             // for exception_ptr, rethrow_exception
+#include <functional>            // for function
+#include <memory>                // for unique_ptr
+#include <mutex>                 // for mutex, lock_guard, unique_lock
+#include <thread>                // for thread, hardware_concurrency
+#include <vector>                // for vector
+
+/// @file
+/// Persistent pool of worker threads shared by all stages of the programme.
+///
+/// Each worker has its own task deque. Tasks submitted by a worker are
+/// pushed to and popped from the back of its own deque, idle workers steal
+/// tasks from the front of the other deques; tasks submitted by other
+/// threads are distributed among the deques in turn. A thread that waits
+/// for a group of tasks executes pending tasks of this group instead of
+/// blocking, so parallel loops may be nested and may be called from
+/// several threads (e.g. server workers) at the same time. Tasks of other
+/// groups are not executed by the waiting thread, so that the time of one
+/// loop (and one server request) does not include the work of the others;
+/// the workers of the pool are still shared.
+
+extern "C" {
+	// defined only if the programme is linked with OpenBLAS
+	void openblas_set_num_threads(int) __attribute__((weak));
+	int openblas_get_num_threads() __attribute__((weak));
+}
+
+namespace autoreg {
+
+	class Thread_pool {
+
+	public:
+		typedef std::function<void ()> task_type;
+
+		explicit
+		Thread_pool(int nworkers) {
+			for (int i=0; i<nworkers; ++i) {
+				_queues.emplace_back(new Queue);
+			}
+			for (int i=0; i<nworkers; ++i) {
+				_threads.emplace_back([this,i] () { work(i); });
+			}
+		}
+
+		~Thread_pool() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_cv.notify_all();
+			for (std::thread& thr : _threads) {
+				thr.join();
+			}
+		}
+
+		Thread_pool(const Thread_pool&) = delete;
+		Thread_pool& operator=(const Thread_pool&) = delete;
+
+		int num_workers() const { return _threads.size(); }
+
+		/// Submit @task of the group @group (an arbitrary tag).
+		void
+		submit(task_type task, const void* group = nullptr) {
+			if (_queues.empty()) {
+				task();
+				return;
+			}
+			int i = worker_index();
+			if (i < 0 || i >= int(_queues.size())) {
+				i = _next++ % _queues.size();
+			}
+			++_pending;
+			{
+				std::lock_guard<std::mutex> lock(_queues[i]->mutex);
+				_queues[i]->tasks.push_back(Task{std::move(task), group});
+			}
+			std::lock_guard<std::mutex> lock(_mutex);
+			_cv.notify_one();
+		}
+
+		/// Execute one pending task of @group in the calling thread.
+		/// Returns false if there are no such tasks.
+		bool
+		run_pending(const void* group) {
+			task_type task;
+			const int i = worker_index();
+			if (!(pop(i, task, group) || steal(i, task, group))) {
+				return false;
+			}
+			task();
+			return true;
+		}
+
+	private:
+		struct Task {
+			task_type func;
+			const void* group;
+		};
+
+		struct Queue {
+			std::deque<Task> tasks;
+			std::mutex mutex;
+		};
+
+		/// Any task matches null @group.
+		static bool
+		matches(const Task& task, const void* group) {
+			return group == nullptr || task.group == group;
+		}
+
+		/// Index of the worker in the current thread, -1 in other threads.
+		static int&
+		worker_index() {
+			static thread_local int index = -1;
+			return index;
+		}
+
+		/// Take the last task of @group from the own deque.
+		bool
+		pop(int i, task_type& task, const void* group = nullptr) {
+			if (i < 0 || i >= int(_queues.size())) {
+				return false;
+			}
+			Queue& q = *_queues[i];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			for (auto it=q.tasks.end(); it!=q.tasks.begin(); ) {
+				--it;
+				if (matches(*it, group)) {
+					task = std::move(it->func);
+					q.tasks.erase(it);
+					--_pending;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/// Take the first task of @group from the other deques.
+		bool
+		steal(int i, task_type& task, const void* group = nullptr) {
+			const int n = _queues.size();
+			for (int k=1; k<=n; ++k) {
+				Queue& q = *_queues[(std::max(i, 0) + k) % n];
+				std::lock_guard<std::mutex> lock(q.mutex);
+				for (auto it=q.tasks.begin(); it!=q.tasks.end(); ++it) {
+					if (matches(*it, group)) {
+						task = std::move(it->func);
+						q.tasks.erase(it);
+						--_pending;
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		void
+		work(int i) {
+			worker_index() = i;
+			while (true) {
+				task_type task;
+				if (pop(i, task) || steal(i, task)) {
+					task();
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cv.wait(lock, [this] () { return _stop || _pending > 0; });
+				if (_stop && _pending <= 0) {
+					return;
+				}
+			}
+		}
+
+		std::vector<std::unique_ptr<Queue>> _queues;
+		std::vector<std::thread> _threads;
+		/// Number of tasks in all queues.
+		std::atomic<long> _pending{0};
+		std::atomic<unsigned> _next{0};
+		bool _stop = false;
+		std::mutex _mutex;
+		std::condition_variable _cv;
+	};
+
+	/// Tasks that are waited for together.
+	class Task_group {
+
+	public:
+		explicit
+		Task_group(Thread_pool& pool):
+		_pool(pool)
+		{}
+
+		~Task_group() {
+			wait_all();
+		}
+
+		Task_group(const Task_group&) = delete;
+		Task_group& operator=(const Task_group&) = delete;
+
+		template<class F>
+		void
+		run(F func) {
+			++_count;
+			_pool.submit([this,func] () {
+				try {
+					func();
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(_mutex);
+					if (!_error) _error = std::current_exception();
+				}
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (--_count == 0) {
+					_cv.notify_all();
+				}
+			}, this);
+		}
+
+		/// Wait for all tasks and rethrow the first exception thrown by them.
+		void
+		wait() {
+			wait_all();
+			if (_error) {
+				std::exception_ptr error = _error;
+				_error = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		void
+		wait_all() {
+			while (_count > 0) {
+				if (!_pool.run_pending(this)) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					// new tasks that can be stolen are checked periodically
+					_cv.wait_for(lock, std::chrono::milliseconds(1),
+						[this] () { return _count == 0; });
+				}
+			}
+			// the last task may still hold the mutex
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+
+		Thread_pool& _pool;
+		std::atomic<int> _count{0};
+		std::exception_ptr _error;
+		std::mutex _mutex;
+		std::condition_variable _cv;
+	};
+
+	/// Limits the number of BLAS threads while the object exists.
+	/// Does nothing if the programme is not linked with OpenBLAS.
+	/// The number should not depend on timing: LAPACK results depend
+	/// on the number of threads.
+	class Blas_threads {
+
+	public:
+		explicit
+		Blas_threads(int n) {
+			if (openblas_set_num_threads && openblas_get_num_threads) {
+				_old = openblas_get_num_threads();
+				openblas_set_num_threads(std::max(1, n));
+			}
+		}
+
+		~Blas_threads() {
+			if (_old > 0) {
+				openblas_set_num_threads(_old);
+			}
+		}
+
+		Blas_threads(const Blas_threads&) = delete;
+		Blas_threads& operator=(const Blas_threads&) = delete;
+
+	private:
+		int _old = 0;
+	};
+
+}
+
+#endif // THREAD_POOL_HH
@@ -1,6 +1,7 @@
 #ifndef VECTOR_N_HH
 #define VECTOR_N_HH
 
+#include <utility>
 #include <blitz/array.h>
 
 /**
@@ -26,6 +27,15 @@ namespace autoreg {
 	template<class T> using Array2D = blitz::Array<T,2>;
 	template<class T> using Array1D = blitz::Array<T,1>;
 
+	// Surfaces may have more than 2^31 points, hence strides and the number
+	// of elements of blitz arrays should be 64-bit. This is the case for
+	// Blitz++ 0.10 and later configured with --enable-64bit-dimensions
+	// (BZ_FULLY64BIT), otherwise blitz uses int.
+	static_assert(sizeof(std::declval<Zeta<float>>().stride(0)) >= 8,
+		"Blitz++ with 64-bit dimensions is required");
+	static_assert(sizeof(std::declval<Zeta<float>>().numElements()) >= 8,
+		"Blitz++ with 64-bit dimensions is required");
+
 }
 
 #endif // VECTOR_N_HH
@@ -1,13 +1,22 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <fstream>
+#include <memory>
+#include <vector>
 
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/freeglut.h>
 #include <GL/freeglut_ext.h>
 
 #include "types.hh"
+#include "zeta_io.hh"
 
 using namespace autoreg;
 
@@ -21,6 +30,10 @@ enum Projection {
 };
 
 Zeta<Real> func;
+/// Binary files are not loaded into @func, but are read on demand.
+std::unique_ptr<Zeta_stream<Real>> stream;
+size3 func_size(0,0,0);
+int window = 32;   /// number of time slices prefetched ahead of the playback
 Vector<Real,3> delta(1,1,1);
 
 const Real ROT_STEP = 90;
@@ -37,41 +50,177 @@ int tail = 0;
 
 
 
+/// Vertices of one time slice decimated with step @step.
+/// Uploaded to the video memory once (VBO) if the driver supports it,
+/// otherwise kept in the client memory and drawn as a vertex array.
+struct Slice_buffer {
+	int t = -1;
+	int step = 0;
+	GLuint vbo = 0;
+	std::vector<GLfloat> vertices;
+};
+
+/// Line indices of the decimated grid, shared by all time slices.
+struct Grid_indices {
+	int step = 0;
+	GLuint ibo = 0;
+	GLsizei count = 0;
+	std::vector<GLuint> indices;
+};
+
+bool vbo_supported = false;
+std::vector<Slice_buffer> slice_buffers;
+Grid_indices grid_indices;
+int wnd_width = 800;
+int wnd_height = 600;
+Real lod_bias = 2; /// minimal distance between grid lines in pixels
+
+/// Decimated grid size.
+int
+decimated_size(int n, int step) {
+	return (n - 1) / step + 1;
+}
+
+/// Choose decimation step so that grid lines are no closer than
+/// @lod_bias pixels to each other at the current scale.
+int
+lod_step() {
+	GLfloat m[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, m);
+	const Real scale = std::sqrt(m[0]*m[0] + m[1]*m[1] + m[2]*m[2]);
+	const Real distance = std::max(Real(1), std::abs(m[14]));
+	// the same field of view as in onResize
+	const Real visible = 2 * distance * std::tan(Real(60 / 360.0f * 3.14159f));
+	const Real pixels_per_cell = std::max(wnd_width, wnd_height) * scale / visible;
+	const int max_step = std::max(1, std::max(func_size(1), func_size(2)) / 2);
+	return std::min(max_step, std::max(1, int(std::ceil(lod_bias / pixels_per_cell))));
+}
+
 void
-draw_vertex(const size3& c, const size3& offset, float alpha) {
-	glColor4f(0.85, 0.85, 0.85, alpha);
-	glVertex3f(c[1]+offset[1], c[2]+offset[2], func(c));
+update_grid_indices(int step) {
+	if (grid_indices.step == step) {
+		return;
+	}
+	const int nx = decimated_size(func_size(1), step);
+	const int ny = decimated_size(func_size(2), step);
+	std::vector<GLuint>& idx = grid_indices.indices;
+	idx.clear();
+	idx.reserve(4*nx*ny);
+	for (int i=0; i<nx; i++) {
+		for (int j=0; j+1<ny; j++) {
+			idx.push_back(i*ny + j);
+			idx.push_back(i*ny + j+1);
+		}
+	}
+	for (int j=0; j<ny; j++) {
+		for (int i=0; i+1<nx; i++) {
+			idx.push_back(i*ny + j);
+			idx.push_back((i+1)*ny + j);
+		}
+	}
+	grid_indices.step = step;
+	grid_indices.count = idx.size();
+	if (vbo_supported) {
+		if (!grid_indices.ibo) glGenBuffers(1, &grid_indices.ibo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid_indices.ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size()*sizeof(GLuint), idx.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		std::vector<GLuint>().swap(idx);
+	}
 }
 
 void
-drawSeries(size_t t, Projection p, float alpha) {
-	const size3& size = func.shape();
+upload_slice(Slice_buffer& buf, int t, int step) {
+	const size3& size = func_size;
 	const size3 offset = -size/2;
-	int x1 = size[1];
-	int y1 = size[2];
-	if (p == PROJECTION_NONE) {
-		for (int i=0; i<x1; i++) {
-			glBegin(GL_LINE_STRIP);
-			for (int j=0; j<y1; j++) {
-				draw_vertex(size3(t, i, j), offset, alpha);
-			}
-			glEnd();
+	const int nx = decimated_size(size[1], step);
+	const int ny = decimated_size(size[2], step);
+	// the slice is held while its vertices are computed
+	Zeta_stream<Real>::slice_ptr slice;
+	const Real* z = nullptr;
+	if (stream) {
+		slice = stream->slice(t);
+		z = slice->data();
+	} else {
+		z = &func(t, 0, 0);
+	}
+	std::vector<GLfloat>& v = buf.vertices;
+	v.resize(3*nx*ny);
+	GLfloat* p = v.data();
+	for (int i=0; i<nx; i++) {
+		for (int j=0; j<ny; j++) {
+			*p++ = i*step + offset[1];
+			*p++ = j*step + offset[2];
+			*p++ = z[size_t(i*step)*size[2] + j*step];
 		}
-		for (int j=0; j<y1; j++) {
-			glBegin(GL_LINE_STRIP);
-			for (int i=0; i<x1; i++)
-				draw_vertex(size3(t, i, j), offset, alpha);
-			glEnd();
+	}
+	buf.t = t;
+	buf.step = step;
+	if (vbo_supported) {
+		if (!buf.vbo) glGenBuffers(1, &buf.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, buf.vbo);
+		glBufferData(GL_ARRAY_BUFFER, v.size()*sizeof(GLfloat), v.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		std::vector<GLfloat>().swap(v);
+	}
+}
+
+/// Find vertex buffer of time slice @t or reuse the buffer of a slice
+/// that is not visible any more.
+Slice_buffer&
+slice_buffer(int t, int step, int first_visible) {
+	Slice_buffer* unused = nullptr;
+	for (Slice_buffer& buf : slice_buffers) {
+		if (buf.t == t && buf.step == step) {
+			return buf;
 		}
-	} else {
-		int len = size[p];
-		size3 d(0, 0, 0);
-		glBegin(GL_LINE_STRIP);
-		for (; d[p]<len; d[p]++) {
-			glVertex3f(d[p]*delta[p], func(d), 0);
+		if (buf.t < first_visible || buf.t > timer || buf.step != step) {
+			unused = &buf;
 		}
-		glEnd();
 	}
+	if (!unused) {
+		slice_buffers.emplace_back();
+		unused = &slice_buffers.back();
+	}
+	upload_slice(*unused, t, step);
+	return *unused;
+}
+
+void
+drawSurface(int t, int step, int first_visible, float alpha) {
+	Slice_buffer& buf = slice_buffer(t, step, first_visible);
+	glColor4f(0.85, 0.85, 0.85, alpha);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (vbo_supported) {
+		glBindBuffer(GL_ARRAY_BUFFER, buf.vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid_indices.ibo);
+		glVertexPointer(3, GL_FLOAT, 0, nullptr);
+		glDrawElements(GL_LINES, grid_indices.count, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	} else {
+		glVertexPointer(3, GL_FLOAT, 0, buf.vertices.data());
+		glDrawElements(GL_LINES, grid_indices.count, GL_UNSIGNED_INT, grid_indices.indices.data());
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+Real
+func_value(const size3& d) {
+	return stream ? stream->value(d(0), d(1), d(2)) : func(d);
+}
+
+void
+drawSeries(size_t, Projection p, float alpha) {
+	const size3& size = func_size;
+	int len = size[p];
+	size3 d(0, 0, 0);
+	glColor4f(0.85, 0.85, 0.85, alpha);
+	glBegin(GL_LINE_STRIP);
+	for (; d[p]<len; d[p]++) {
+		glVertex3f(d[p]*delta[p], func_value(d), 0);
+	}
+	glEnd();
 }
 
 void draw_axis(const GLfloat v[3]) {
@@ -111,13 +260,20 @@ void onDisplay() {
 	glClearColor(0.25, 0.25, 0.25, 1.0);
 
 	const int tl = std::min(tail, timer);
-	for (int t=timer-tl, i=1; t<=timer; ++t, ++i) {
-		drawSeries(t, proj, i/(tl+1.0));
-		//clog << i/(tail+1.0) << endl;
+	if (proj == PROJECTION_NONE) {
+		const int step = lod_step();
+		update_grid_indices(step);
+		for (int t=timer-tl, i=1; t<=timer; ++t, ++i) {
+			drawSurface(t, step, timer-tl, i/(tl+1.0));
+		}
+	} else {
+		for (int t=timer-tl, i=1; t<=timer; ++t, ++i) {
+			drawSeries(t, proj, i/(tl+1.0));
+		}
 	}
 
 	std::stringstream str;
-	str << "t=" << timer << '/' << func.extent(2)-1;
+	str << "t=" << timer << '/' << func_size(0)-1;
 
 	glMatrixMode(GL_PROJECTION);
 	glPushMatrix();
@@ -154,6 +310,8 @@ void onMouseDrag(int x, int y) {
 }
 
 void onResize(int w, int h) {
+	wnd_width = std::max(w, 1);
+	wnd_height = std::max(h, 1);
 	glViewport(0, 0, w, h);
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
@@ -187,6 +345,9 @@ void onKeyPressed(unsigned char key, int, int) {
 	if (key == ']') glScalef(1.5f, 1.5f, 1.5f);
 	if (key == '[') glScalef(0.9f, 0.9f, 0.9f);
 
+	if (key == '+') lod_bias = std::max(Real(0.25), lod_bias/2);
+	if (key == '-') lod_bias = std::min(Real(64), lod_bias*2);
+
 	if (key == 'h') glTranslatef( 2.0f,  0.0f, 0.0f);
 	if (key == 'l') glTranslatef(-2.0f,  0.0f, 0.0f);
 	if (key == 'k') glTranslatef( 0.0f,  2.0f, 0.0f);
@@ -233,7 +394,7 @@ void onSpecialKeyPressed(int key, int, int) {
 		if (paused) {
 			if (key == GLUT_KEY_LEFT)  timer -= lag;
 			if (key == GLUT_KEY_RIGHT) timer += lag;
-			int sz = func.extent(0);
+			int sz = func_size(0);
 			if (timer >= sz) timer = sz-1;
 		}
 	}
@@ -252,11 +413,22 @@ int get_delta_t() {
 void onTimer(int) {
     glutTimerFunc(get_delta_t(), onTimer, 0);
 	if (!paused) timer++;
-	if (timer >= func.extent(0))
+	if (timer >= func_size(0))
 		timer = 0;
 	glutPostRedisplay();
 }
 
+/// VBO are core since OpenGL 1.5, indirect GLX contexts may report less.
+bool has_vbo() {
+	const char* version = (const char*)glGetString(GL_VERSION);
+	int major = 0, minor = 0;
+	if (version && std::sscanf(version, "%d.%d", &major, &minor) == 2) {
+		if (major > 1 || (major == 1 && minor >= 5)) return true;
+	}
+	const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+	return ext && std::strstr(ext, "GL_ARB_vertex_buffer_object");
+}
+
 void initOpenGL(int argc, char** argv) {
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
     glutInit(&argc, argv);
@@ -280,6 +452,8 @@ void initOpenGL(int argc, char** argv) {
 	glEnable(GL_BLEND);
 	glDisable(GL_DEPTH_TEST);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	vbo_supported = has_vbo();
+	std::clog << "vertex buffers: " << (vbo_supported ? "yes" : "no") << std::endl;
 	onResize(800, 600);
 	resetView();
 }
@@ -298,20 +472,27 @@ void parse_cmdline(int argc, char** argv) {
 	while (!(cmdline >> ar).eof()) {
 		if (ar == "-r") cmdline >> tail;
 		else if (ar == "-t") cmdline >> timer;
+		else if (ar == "-w") cmdline >> window;
 		else {
 			file_name = ar;
 		}
 		cmdline >> ws;
 	}
-	if (!file_name.empty()) {
-		clog << "reading " << ar << endl;
-		ifstream in(ar.c_str());
-		read_valarray(in);
+	if (!file_name.empty() && is_binary_zeta(file_name)) {
+		clog << "streaming " << file_name << endl;
+		// slices of the tail are drawn behind the current one
+		stream.reset(new Zeta_stream<Real>(file_name, window, tail + 1));
+		func_size = stream->shape();
+	} else if (!file_name.empty()) {
+		clog << "reading " << file_name << endl;
+		func.reference(read_zeta<Real>(file_name));
+		func_size = func.shape();
 	} else {
 		read_valarray(cin);
+		func_size = func.shape();
 	}
-	if (timer >= func.extent(0)) {
-		timer = func.extent(0)-1;
+	if (timer >= func_size(0)) {
+		timer = func_size(0)-1;
 	}
 }
 
@@ -3,7 +3,10 @@
 
 #include <assert.h>             // for assert
 #include <cstdlib>              // for abs
+#include <limits>               // for numeric_limits
+#include <stdexcept>            // for runtime_error
 #include <blitz/array.h>        // for Array, Range, shape, any
+#include "parallel.hh"          // for parallel_for
 #include "types.hh"             // for Array2D, ACF
 
 namespace autoreg {
@@ -66,18 +69,51 @@ namespace autoreg {
 		return result;
 	}
 
+	/// The order of autocovariance matrix of @acf (the number of
+	/// Yule-Walker equations); matrix dimensions are int.
+	template<class T>
+	int
+	AC_matrix_order(const ACF<T>& acf) {
+		const size_t n = acf.numElements();
+		if (n > size_t(std::numeric_limits<int>::max())) {
+			throw std::runtime_error("autocovariance matrix is too large");
+		}
+		return int(n);
+	}
+
+	/// Fill preallocated matrix @result with autocovariance matrix
+	/// (the same as assembled by blocks with AC_matrix_block) without
+	/// temporary blocks. Rows are filled in parallel.
+	template<class T>
+	void
+	generate_AC_matrix(const ACF<T>& acf, Array2D<T>& result) {
+		const int n1 = acf.extent(1);
+		const int n2 = acf.extent(2);
+		const int n = AC_matrix_order(acf);
+		if (result.extent(0) != n || result.extent(1) != n) {
+			throw std::runtime_error("bad size of autocovariance matrix");
+		}
+		parallel_for(0, n, [&] (int first, int last) {
+			for (int i=first; i<last; ++i) {
+				const int t1 = i / (n1*n2);
+				const int x1 = i / n2 % n1;
+				const int y1 = i % n2;
+				for (int j=0; j<n; ++j) {
+					const int t2 = j / (n1*n2);
+					const int x2 = j / n2 % n1;
+					const int y2 = j % n2;
+					result(i, j) = acf(std::abs(t1-t2), std::abs(x1-x2), std::abs(y1-y2));
+				}
+			}
+		});
+	}
+
 	template<class T>
 	Array2D<T>
 	generate_AC_matrix(const ACF<T>& acf) {
-		const int n = acf.extent(0);
-		Array2D<T> result;
-		for (int i=0; i<n; ++i) {
-			Array2D<T> row;
-			for (int j=0; j<n; ++j) {
-				append_column_block(row, AC_matrix_block(acf, std::abs(i-j)));
-			}
-			append_row_block(result, row);
-		}
+		const int n = AC_matrix_order(acf);
+		Array2D<T> result(blitz::shape(n, n));
+		generate_AC_matrix(acf, result);
 		return result;
 	}
 
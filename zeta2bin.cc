@@ -0,0 +1,53 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "zeta_io.hh"
+
+/// @file
+/// Converts wavy surface from blitz text format to binary format
+/// that is loaded without parsing.
+///
+/// Usage: zeta2bin [-d] input output
+/// -d  values are double precision (single precision by default)
+
+using namespace autoreg;
+
+template<class T>
+void
+convert(const std::string& input, const std::string& output) {
+	auto t0 = std::chrono::steady_clock::now();
+	Zeta<T> zeta = read_zeta<T>(input);
+	auto t1 = std::chrono::steady_clock::now();
+	write_zeta_binary(output, zeta);
+	auto t2 = std::chrono::steady_clock::now();
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+	std::clog << "shape: " << zeta.shape() << '\n'
+		<< "read:  " << duration_cast<milliseconds>(t1 - t0).count() << " ms\n"
+		<< "write: " << duration_cast<milliseconds>(t2 - t1).count() << " ms" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	bool dbl = false;
+	std::string names[2];
+	int n = 0;
+	for (int i=1; i<argc; ++i) {
+		const std::string ar = argv[i];
+		if (ar == "-d") dbl = true;
+		else if (n < 2) names[n++] = ar;
+	}
+	if (n != 2) {
+		std::cerr << "usage: " << argv[0] << " [-d] input output" << std::endl;
+		return 1;
+	}
+	try {
+		if (dbl) convert<double>(names[0], names[1]);
+		else convert<float>(names[0], names[1]);
+	} catch (const std::exception& err) {
+		std::cerr << err.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,607 @@
+#ifndef ZETA_IO_HH
+#define ZETA_IO_HH
+
+#include <algorithm>             // for min, max, find
+#include <cerrno>                // for errno, EINTR
+#include <condition_variable>    // for condition_variable
+#include <cstdint>               // for int64_t, uint32_t
+#include <cstdlib>               // for strtod, strtof, abs
+#include <cstring>               // for memcmp, memcpy
+#include <fstream>               // for ofstream
+#include <limits>                // for numeric_limits
+#include <map>                   // for map
+#include <memory>                // for shared_ptr
+#include <mutex>                 // for mutex, lock_guard
+#include <stdexcept>             // for runtime_error
+#include <string>                // for string
+#include <thread>                // for thread
+#include <vector>                // for vector
+
+#include <fcntl.h>               // for open
+#include <sys/mman.h>            // for mmap, munmap, madvise
+#include <sys/stat.h>            // for fstat
+#include <unistd.h>              // for close, pread
+
+#include "parallel.hh"           // for parallel_for, parallel_threads
+#include "types.hh"              // for Zeta, size3
+
+/// @file
+/// Fast input/output of wavy surface files.
+///
+/// Text files are written by blitz: a header with index ranges of every
+/// dimension, e.g. "(0,999) x (0,31) x (0,31)", followed by the values in
+/// square brackets. They are memory-mapped, split into line-aligned
+/// chunks and parsed in parallel straight into the resulting array.
+///
+/// Binary files consist of @Zeta_header followed by the values in
+/// row-major order. They can also be read slice by slice with
+/// @Zeta_stream, without loading the whole file.
+
+namespace autoreg {
+
+	/// Header of binary wavy surface file.
+	struct Zeta_header {
+		char magic[4] = {'Z', 'E', 'T', 'A'};
+		uint32_t version = 1;
+		/// Size of one value in bytes (4 for float, 8 for double).
+		uint32_t value_size = 0;
+		uint32_t rank = 3;
+		int64_t extent[3] = {0, 0, 0};
+
+		bool
+		is_valid() const {
+			return std::memcmp(magic, Zeta_header().magic, 4) == 0;
+		}
+
+		/// Extents as array shape. Each extent is limited by the range of
+		/// int, the number of values is not.
+		size3
+		shape() const {
+			size3 result;
+			for (int i=0; i<3; ++i) {
+				result(i) = checked_extent(extent[i]);
+			}
+			return result;
+		}
+
+		static int
+		checked_extent(int64_t n) {
+			if (n < 0 || n > std::numeric_limits<int>::max()) {
+				throw std::runtime_error("bad zeta extent");
+			}
+			return int(n);
+		}
+	};
+
+	/// Read-only memory mapping of the whole file.
+	struct Mapped_file {
+
+		explicit
+		Mapped_file(const std::string& filename) {
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if (fd == -1) {
+				throw std::runtime_error("unable to open " + filename);
+			}
+			struct ::stat st;
+			if (::fstat(fd, &st) == -1) {
+				::close(fd);
+				throw std::runtime_error("unable to stat " + filename);
+			}
+			_size = st.st_size;
+			if (_size > 0) {
+				void* ptr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (ptr == MAP_FAILED) {
+					::close(fd);
+					throw std::runtime_error("unable to map " + filename);
+				}
+				::madvise(ptr, _size, MADV_SEQUENTIAL);
+				_data = static_cast<const char*>(ptr);
+			}
+			::close(fd);
+		}
+
+		~Mapped_file() {
+			if (_data) {
+				::munmap(const_cast<char*>(_data), _size);
+			}
+		}
+
+		Mapped_file(const Mapped_file&) = delete;
+		Mapped_file& operator=(const Mapped_file&) = delete;
+
+		const char* begin() const { return _data; }
+		const char* end() const { return _data + _size; }
+		size_t size() const { return _size; }
+
+	private:
+		const char* _data = nullptr;
+		size_t _size = 0;
+	};
+
+	inline bool
+	is_space(char ch) noexcept {
+		return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+	}
+
+	inline bool
+	is_delimiter(char ch) noexcept {
+		return is_space(ch) || ch == ']';
+	}
+
+	/// Powers of ten that are exactly representable in type @T.
+	template<class T>
+	T
+	exact_power_of_ten(int n) {
+		static const T powers[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		return powers[n];
+	}
+
+	template<class T> struct max_exact_power_of_ten;
+	template<> struct max_exact_power_of_ten<float> { static const int value = 10; };
+	template<> struct max_exact_power_of_ten<double> { static const int value = 22; };
+
+	inline char* convert_slow(const char* str, float& out) { char* end; out = std::strtof(str, &end); return end; }
+	inline char* convert_slow(const char* str, double& out) { char* end; out = std::strtod(str, &end); return end; }
+
+	/// Parse one decimal number starting at @first and return the pointer
+	/// past its last character.
+	///
+	/// Numbers with short mantissa and small exponent (all numbers written
+	/// by iostreams with default precision) are converted with one exact
+	/// multiplication or division, which gives correctly rounded result.
+	/// Everything else (long mantissas, nan, inf) goes to strtod.
+	template<class T>
+	const char*
+	parse_value(const char* first, const char* last, T& out) {
+		const char* p = first;
+		bool negative = false;
+		if (p != last && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			++p;
+		}
+		uint64_t mantissa = 0;
+		int ndigits = 0;
+		int exponent = 0;
+		bool any_digits = false;
+		for (; p != last && *p >= '0' && *p <= '9'; ++p) {
+			any_digits = true;
+			if (mantissa == 0 && *p == '0') continue;
+			mantissa = mantissa*10 + (*p - '0');
+			++ndigits;
+		}
+		if (p != last && *p == '.') {
+			for (++p; p != last && *p >= '0' && *p <= '9'; ++p) {
+				any_digits = true;
+				if (mantissa == 0 && *p == '0') { --exponent; continue; }
+				mantissa = mantissa*10 + (*p - '0');
+				++ndigits;
+				--exponent;
+			}
+		}
+		if (any_digits && p != last && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool exp_negative = false;
+			if (q != last && (*q == '-' || *q == '+')) {
+				exp_negative = *q == '-';
+				++q;
+			}
+			if (q != last && *q >= '0' && *q <= '9') {
+				int e = 0;
+				for (; q != last && *q >= '0' && *q <= '9'; ++q) {
+					if (e < 100000) e = e*10 + (*q - '0');
+				}
+				exponent += exp_negative ? -e : e;
+				p = q;
+			}
+		}
+		const int max_pow = max_exact_power_of_ten<T>::value;
+		const uint64_t max_mantissa = uint64_t(1) << std::numeric_limits<T>::digits;
+		if (any_digits && (p == last || is_delimiter(*p))
+			&& ndigits <= 19 && mantissa <= max_mantissa
+			&& exponent >= -max_pow && exponent <= max_pow)
+		{
+			T value = T(mantissa);
+			if (exponent < 0) value /= exact_power_of_ten<T>(-exponent);
+			else value *= exact_power_of_ten<T>(exponent);
+			out = negative ? -value : value;
+			return p;
+		}
+		// slow path: copy the token and let the C library do the work
+		p = first;
+		while (p != last && !is_delimiter(*p)) ++p;
+		if (p == first || p - first > 127) {
+			throw std::runtime_error("bad number in zeta file: " + std::string(first, std::min(p, first+32)));
+		}
+		char buf[128];
+		std::copy(first, p, buf);
+		buf[p - first] = 0;
+		// the whole token should be a number (not a lone sign)
+		if (*convert_slow(buf, out) != 0) {
+			throw std::runtime_error("bad zeta file: bad number " + std::string(buf));
+		}
+		return p;
+	}
+
+	/// Count whitespace separated tokens in [first,last).
+	inline size_t
+	count_values(const char* first, const char* last) {
+		size_t n = 0;
+		bool in_token = false;
+		for (const char* p = first; p != last; ++p) {
+			const bool delim = is_delimiter(*p);
+			if (!delim && !in_token) ++n;
+			in_token = !delim;
+		}
+		return n;
+	}
+
+	/// Parse blitz array header "(l0,u0) x (l1,u1) x (l2,u2) [" and return
+	/// the pointer past the opening bracket.
+	inline const char*
+	parse_text_header(const char* first, const char* last, size3& shape) {
+		const char* p = first;
+		for (int i=0; i<3; ++i) {
+			p = std::find(p, last, '(');
+			if (p == last) break;
+			char* end = nullptr;
+			const long lo = std::strtol(p+1, &end, 10);
+			p = std::find((const char*)end, last, ',');
+			if (p == last) break;
+			const long hi = std::strtol(p+1, &end, 10);
+			p = end;
+			shape(i) = Zeta_header::checked_extent(hi - lo + 1);
+		}
+		p = std::find(p, last, '[');
+		if (p == last) {
+			throw std::runtime_error("bad zeta file header");
+		}
+		return p + 1;
+	}
+
+	/// Number of chunks the file is split into for parsing.
+	inline int
+	io_threads() {
+		return parallel_threads();
+	}
+
+	/// Parse text file written by blitz in parallel
+	/// (@nthreads chunks in the threads of the pool).
+	template<class T>
+	Zeta<T>
+	parse_zeta_text(const char* first, const char* last, int nthreads = io_threads()) {
+		size3 shape(0, 0, 0);
+		const char* data = parse_text_header(first, last, shape);
+		const char* data_end = last;
+		while (data_end != data && *(data_end-1) != ']') --data_end;
+		if (data_end == data) {
+			throw std::runtime_error("no closing bracket in zeta file");
+		}
+		--data_end;
+		Zeta<T> zeta(shape);
+		if (!zeta.isStorageContiguous()) {
+			throw std::runtime_error("zeta array is not contiguous");
+		}
+
+		// chunk boundaries are moved to the end of the line
+		// or at least to the next whitespace character
+		const size_t len = data_end - data;
+		nthreads = int(std::max(size_t(1), std::min(size_t(nthreads), len / 4096 + 1)));
+		std::vector<const char*> bounds(nthreads + 1, data_end);
+		bounds[0] = data;
+		for (int i=1; i<nthreads; ++i) {
+			const char* p = data + len*i/nthreads;
+			p = std::max(p, bounds[i-1]);
+			const char* next_line = std::find(p, data_end, '\n');
+			if (next_line == data_end || next_line - p > 4096) {
+				next_line = p;
+				while (next_line != data_end && !is_space(*next_line)) ++next_line;
+			}
+			bounds[i] = next_line;
+		}
+
+		std::vector<size_t> counts(nthreads + 1, 0);
+		parallel_for(0, nthreads, [&bounds,&counts] (int first, int last) {
+			for (int i=first; i<last; ++i) {
+				counts[i+1] = count_values(bounds[i], bounds[i+1]);
+			}
+		});
+		for (int i=0; i<nthreads; ++i) counts[i+1] += counts[i];
+		if (counts[nthreads] != zeta.numElements()) {
+			throw std::runtime_error("number of values does not match zeta file header");
+		}
+
+		T* result = zeta.data();
+		parallel_for(0, nthreads, [&bounds,&counts,result] (int first, int last) {
+			for (int i=first; i<last; ++i) {
+				T* out = result + counts[i];
+				const char* p = bounds[i];
+				const char* end = bounds[i+1];
+				while (true) {
+					while (p != end && is_delimiter(*p)) ++p;
+					if (p == end) break;
+					p = parse_value(p, end, *out++);
+				}
+			}
+		});
+		return zeta;
+	}
+
+	template<class T>
+	Zeta<T>
+	parse_zeta_binary(const char* first, const char* last) {
+		Zeta_header header;
+		if (size_t(last - first) < sizeof(header)) {
+			throw std::runtime_error("truncated zeta file");
+		}
+		std::memcpy(&header, first, sizeof(header));
+		if (header.rank != 3 || header.value_size != sizeof(T)) {
+			throw std::runtime_error("zeta file has different precision or rank");
+		}
+		const size3 shape = header.shape();
+		Zeta<T> zeta(shape);
+		const size_t nbytes = zeta.numElements()*sizeof(T);
+		if (size_t(last - first) < sizeof(header) + nbytes) {
+			throw std::runtime_error("truncated zeta file");
+		}
+		std::memcpy(zeta.data(), first + sizeof(header), nbytes);
+		return zeta;
+	}
+
+	/// Read wavy surface from text or binary file.
+	template<class T>
+	Zeta<T>
+	read_zeta(const std::string& filename) {
+		Mapped_file file(filename);
+		Zeta_header header;
+		if (file.size() >= sizeof(header)) {
+			std::memcpy(&header, file.begin(), sizeof(header));
+			if (header.is_valid()) {
+				return parse_zeta_binary<T>(file.begin(), file.end());
+			}
+		}
+		return parse_zeta_text<T>(file.begin(), file.end());
+	}
+
+	template<class T>
+	void
+	write_zeta_binary(std::ostream& out, const Zeta<T>& zeta) {
+		Zeta_header header;
+		header.value_size = sizeof(T);
+		for (int i=0; i<3; ++i) {
+			header.extent[i] = zeta.extent(i);
+		}
+		out.write((const char*)&header, sizeof(header));
+		if (zeta.isStorageContiguous()) {
+			out.write((const char*)zeta.data(), zeta.numElements()*sizeof(T));
+		} else {
+			for (auto it = zeta.begin(); it != zeta.end(); ++it) {
+				const T value = *it;
+				out.write((const char*)&value, sizeof(T));
+			}
+		}
+	}
+
+	template<class T>
+	void
+	write_zeta_binary(const std::string& filename, const Zeta<T>& zeta) {
+		std::ofstream out(filename, std::ios::binary);
+		if (!out.is_open()) {
+			throw std::runtime_error("unable to write " + filename);
+		}
+		write_zeta_binary(out, zeta);
+	}
+
+	/// Read exactly @n bytes at @offset.
+	inline void
+	read_at(int fd, void* buf, size_t n, off_t offset) {
+		char* p = static_cast<char*>(buf);
+		while (n > 0) {
+			const ssize_t m = ::pread(fd, p, n, offset);
+			if (m == -1 && errno == EINTR) continue;
+			if (m <= 0) {
+				throw std::runtime_error("truncated zeta file");
+			}
+			p += m;
+			n -= m;
+			offset += m;
+		}
+	}
+
+	/// Check if @filename starts with binary header.
+	inline bool
+	is_binary_zeta(const std::string& filename) {
+		std::ifstream in(filename, std::ios::binary);
+		Zeta_header header;
+		return in.read((char*)&header, sizeof(header)) && header.is_valid();
+	}
+
+	/// Binary wavy surface file that is read on demand by time slices.
+	///
+	/// Only the slices in a window around the current playback position
+	/// are kept in memory: @ahead slices in the direction of playback and
+	/// @behind slices in the opposite direction. Background thread reads
+	/// the slices ahead of the position (wrapping around the end of the
+	/// file) and evicts the slices that left the window, so the memory
+	/// does not depend on the number of slices in the file.
+	template<class T>
+	class Zeta_stream {
+
+	public:
+		typedef std::shared_ptr<const std::vector<T>> slice_ptr;
+
+		explicit
+		Zeta_stream(const std::string& filename, int ahead = 32, int behind = 8):
+		_ahead(std::max(ahead, 1)),
+		_behind(std::max(behind, 0))
+		{
+			_fd = ::open(filename.c_str(), O_RDONLY);
+			if (_fd == -1) {
+				throw std::runtime_error("unable to open " + filename);
+			}
+			Zeta_header header;
+			try {
+				read_at(_fd, &header, sizeof(header), 0);
+				if (!header.is_valid() || header.rank != 3 || header.value_size != sizeof(T)) {
+					throw std::runtime_error("not a binary zeta file of the same precision: " + filename);
+				}
+				_shape = header.shape();
+			} catch (...) {
+				::close(_fd);
+				throw;
+			}
+			if (_shape(0) <= 0 || _shape(1) <= 0 || _shape(2) <= 0) {
+				::close(_fd);
+				throw std::runtime_error("empty zeta file: " + filename);
+			}
+			_slice_size = size_t(_shape(1))*size_t(_shape(2));
+			_thread = std::thread([this] () { prefetch(); });
+		}
+
+		~Zeta_stream() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_cv.notify_all();
+			_thread.join();
+			::close(_fd);
+		}
+
+		Zeta_stream(const Zeta_stream&) = delete;
+		Zeta_stream& operator=(const Zeta_stream&) = delete;
+
+		const size3& shape() const { return _shape; }
+		int extent(int i) const { return _shape(i); }
+
+		/// Time slice @t in row-major order. Moves playback position to @t,
+		/// blocks only if the slice was not prefetched.
+		slice_ptr
+		slice(int t) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (t != _position) {
+				_direction = t > _position ? 1 : -1;
+				_position = t;
+				++_generation;
+				_cv.notify_all();
+			}
+			auto it = _slices.find(t);
+			if (it != _slices.end()) {
+				++_hits;
+				return it->second;
+			}
+			++_misses;
+			lock.unlock();
+			slice_ptr result = read_slice(t);
+			lock.lock();
+			if (in_window(t)) {
+				_slices.emplace(t, result);
+			}
+			return result;
+		}
+
+		/// Single value; the slice is read only if it is not in memory.
+		T
+		value(int t, int x, int y) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				auto it = _slices.find(t);
+				if (it != _slices.end()) {
+					return (*it->second)[size_t(x)*_shape(2) + y];
+				}
+			}
+			T result;
+			read_at(_fd, &result, sizeof(T), offset(t) + (off_t(x)*_shape(2) + y)*sizeof(T));
+			return result;
+		}
+
+		/// Number of slices in memory.
+		size_t
+		resident() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _slices.size();
+		}
+
+		/// Number of slice requests served from memory and from the file.
+		size_t hits() { std::lock_guard<std::mutex> lock(_mutex); return _hits; }
+		size_t misses() { std::lock_guard<std::mutex> lock(_mutex); return _misses; }
+
+	private:
+		off_t
+		offset(int t) const {
+			return off_t(sizeof(Zeta_header)) + off_t(t)*off_t(_slice_size*sizeof(T));
+		}
+
+		slice_ptr
+		read_slice(int t) const {
+			std::shared_ptr<std::vector<T>> result(new std::vector<T>(_slice_size));
+			read_at(_fd, result->data(), _slice_size*sizeof(T), offset(t));
+			return result;
+		}
+
+		/// Distance from the position to @t in the direction of playback
+		/// (and in the opposite direction), taking wrap-around into account.
+		bool
+		in_window(int t) const {
+			const int n = _shape(0);
+			const int forward = ((t - _position)*_direction % n + n) % n;
+			const int backward = ((_position - t)*_direction % n + n) % n;
+			return forward <= _ahead || backward <= _behind;
+		}
+
+		void
+		prefetch() {
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (!_stop) {
+				const size_t generation = _generation;
+				// evict slices behind the playback
+				for (auto it = _slices.begin(); it != _slices.end(); ) {
+					if (in_window(it->first)) ++it;
+					else it = _slices.erase(it);
+				}
+				// read the nearest missing slices first, ahead of the position,
+				// then behind it; start over when the position changes
+				const int n = _shape(0);
+				for (int i=0; i<=_ahead+_behind && !_stop && generation == _generation; ++i) {
+					const int k = i <= _ahead ? i : _ahead - i;
+					const int t = ((_position + k*_direction) % n + n) % n;
+					if (_slices.count(t)) continue;
+					lock.unlock();
+					slice_ptr s;
+					try {
+						s = read_slice(t);
+					} catch (...) {
+						// the error is reported by the blocking read
+					}
+					lock.lock();
+					if (s && in_window(t)) {
+						_slices.emplace(t, s);
+					}
+				}
+				_cv.wait(lock, [this,generation] () { return _stop || generation != _generation; });
+			}
+		}
+
+		int _fd = -1;
+		size3 _shape;
+		size_t _slice_size = 0;
+		int _ahead;
+		int _behind;
+		std::map<int,slice_ptr> _slices;
+		int _position = 0;
+		int _direction = 1;
+		/// Incremented each time the position changes.
+		size_t _generation = 0;
+		size_t _hits = 0;
+		size_t _misses = 0;
+		bool _stop = false;
+		std::mutex _mutex;
+		std::condition_variable _cv;
+		std::thread _thread;
+	};
+
+}
+
+#endif // ZETA_IO_HH